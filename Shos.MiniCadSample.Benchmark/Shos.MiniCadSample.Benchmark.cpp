@@ -0,0 +1,92 @@
+﻿#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <list>
+#include <string>
+#include "../Shos.MiniCadSample/undo_redo_vector.h"
+
+using namespace shos;
+
+const std::size_t element_count   = 1000000;
+const std::size_t operation_count = 1000;
+
+class stopwatch
+{
+    std::chrono::steady_clock::time_point start;
+
+public:
+    stopwatch() : start(std::chrono::steady_clock::now())
+    {}
+
+    double milliseconds() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+void report(const std::string& backend, const std::string& operation, double milliseconds)
+{
+    std::cout << std::left << std::setw(10) << backend << std::setw(34) << operation
+              << std::right << std::setw(12) << std::fixed << std::setprecision(2) << milliseconds << " ms" << std::endl;
+}
+
+// Runs the same edits on an undo_redo_collection over each backend: every one erases in the middle, and undoing it inserts there.
+template <typename TCollection>
+void benchmark(const std::string& backend)
+{
+    undo_redo_collection<int, TCollection, null_disposer> array;
+    std::mt19937                                          random(1);
+
+    {
+        stopwatch watch;
+        for (std::size_t index = 0; index < element_count; index++)
+            array.push_back(static_cast<int>(index));
+        report(backend, "push_back x 1M", watch.milliseconds());
+    }
+    {
+        stopwatch watch;
+        for (std::size_t count = 0; count < operation_count; count++)
+            array.erase(std::next(array.begin(), random() % array.size()));
+        report(backend, "erase at random x 1K", watch.milliseconds());
+    }
+    {
+        stopwatch watch;
+        for (std::size_t count = 0; count < operation_count; count++)
+            array.undo();
+        report(backend, "undo erase (insert) x 1K", watch.milliseconds());
+    }
+    {
+        stopwatch watch;
+        for (std::size_t count = 0; count < operation_count; count++)
+            array.update(std::next(array.begin(), random() % array.size()), static_cast<int>(count));
+        report(backend, "update at random x 1K", watch.milliseconds());
+    }
+    {
+        std::vector<std::size_t> indices;
+        for (std::size_t index = 0; index < array.size(); index += array.size() / operation_count)
+            indices.push_back(index);
+
+        stopwatch watch;
+        array.erase(indices);
+        array.undo();
+        report(backend, "bulk erase and undo of 1K", watch.milliseconds());
+    }
+    {
+        stopwatch watch;
+        long long sum = 0;
+        for (auto element : array)
+            sum += element;
+        report(backend, "iterate x 1M", watch.milliseconds());
+        if (sum == 0)
+            std::cout << std::endl;
+    }
+}
+
+int main()
+{
+    benchmark<std::vector<int>>    ("vector" );
+    benchmark<std::list<int>>      ("list"   );
+    benchmark<chunked_vector<int>> ("chunked");
+}
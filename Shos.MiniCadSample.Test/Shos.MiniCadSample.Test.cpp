@@ -2,8 +2,13 @@
 #include "CppUnitTest.h"
 #include <vector>
 #include <list>
+#include <map>
+#include <memory>
 #include <iterator>
+#include <thread>
 #include "../Shos.MiniCadSample/undo_redo_vector.h"
+#include "../Shos.MiniCadSample/area_cache.h"
+#include "../Shos.MiniCadSample/size_class_pool.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -36,6 +41,55 @@ namespace ShosMiniCadSampleTest
             Assert::AreEqual<std::size_t>(6, std::distance(array.begin(), iterator));
         }
 
+        TEST_METHOD(check_chunked_vector)
+        {
+            chunked_vector<int, 4> array;
+            std::vector<int>       expected;
+            unsigned int           random = 1;
+            for (int value = 0; value < 2000; value++) {
+                random = random * 1103515245 + 12345;
+                auto position = expected.empty() ? 0 : (random >> 8) % expected.size();
+                switch (random % 5) {
+                case 0:
+                case 1:
+                    array.insert(array.cbegin() + position, value);
+                    expected.insert(expected.begin() + position, value);
+                    break;
+                case 2:
+                    array.push_back(value);
+                    expected.push_back(value);
+                    break;
+                case 3:
+                    if (!expected.empty()) {
+                        auto iterator = array.erase(array.cbegin() + position);
+                        Assert::AreEqual<std::size_t>(position, iterator - array.begin());
+                        expected.erase(expected.begin() + position);
+                    }
+                    break;
+                default:
+                    {
+                        auto last = (std::min)(position + random % 9, expected.size());
+                        array.erase(array.cbegin() + position, array.cbegin() + last);
+                        expected.erase(expected.begin() + position, expected.begin() + last);
+                    }
+                    break;
+                }
+                Assert::AreEqual(expected.size(), array.size());
+            }
+            Assert::IsTrue(std::equal(array.cbegin(), array.cend(), expected.cbegin(), expected.cend()));
+            for (std::size_t index = 0; index < expected.size(); index++)
+                Assert::AreEqual(expected[index], array[index]);
+            Assert::IsTrue(std::equal(expected.crbegin(), expected.crend(), std::reverse_iterator<chunked_vector<int, 4>::const_iterator>(array.cend())));
+
+            array.resize(expected.size() + 10);
+            Assert::AreEqual(0, array.back());
+            array.resize(3);
+            Assert::AreEqual<std::size_t>(3, std::distance(array.begin(), array.end()));
+            array.erase(array.begin(), array.end());
+            Assert::IsTrue(array.empty());
+            Assert::IsTrue(array.begin() == array.end());
+        }
+
         TEST_METHOD(construct)
         {
             undo_redo_vector<int> array;
@@ -309,6 +363,29 @@ namespace ShosMiniCadSampleTest
             Assert::AreEqual<int>(array[1], 400);
         }
 
+        TEST_METHOD(large_transaction)
+        {
+            const auto count = 100000;
+
+            undo_redo_vector<int> array;
+            {
+                undo_redo_vector<int>::transaction transaction(array);
+                for (auto value = 0; value < count; value++)
+                    array.push_back(value);
+                for (auto iterator = array.begin(); iterator != array.end(); iterator++)
+                    array.update(iterator, -*iterator);
+            }
+            Assert::AreEqual(size_t(1), array.history_size());
+            Assert::AreEqual(-(count - 1), array[count - 1]);
+
+            Assert::IsTrue(array.undo());
+            Assert::AreEqual(size_t(0), array.size());
+
+            Assert::IsTrue(array.redo());
+            Assert::AreEqual(size_t(count), array.size());
+            Assert::AreEqual(-(count - 1), array[count - 1]);
+        }
+
         TEST_METHOD(clear)
         {
             undo_redo_vector<int> array;
@@ -332,6 +409,293 @@ namespace ShosMiniCadSampleTest
             Assert::AreEqual<int>(array[1], 200);
         }
 
+        class element_observer : public undo_redo_vector<int>::observer
+        {
+        public:
+            std::vector<int> elements;
+
+            virtual void on_added(std::size_t index, const int& element) override
+            {
+                elements.insert(std::next(elements.begin(), index), element);
+            }
+
+            virtual void on_removed(std::size_t index, const int& element) override
+            {
+                Assert::AreEqual<int>(elements[index], element);
+                elements.erase(std::next(elements.begin(), index));
+            }
+
+            virtual void on_reset() override
+            {
+                elements.clear();
+            }
+        };
+
+        static bool equals(const undo_redo_vector<int>& array, const std::vector<int>& elements)
+        {
+            return std::equal(array.cbegin(), array.cend(), elements.cbegin(), elements.cend());
+        }
+
+        TEST_METHOD(observer)
+        {
+            undo_redo_vector<int> array;
+            element_observer      observer;
+            array.add_observer(observer);
+
+            array.push_back(100);
+            array.push_back(200);
+            array.push_back(400);
+            Assert::IsTrue(equals(array, observer.elements));
+
+            array.erase(std::next(array.begin(), 1));
+            Assert::IsTrue(equals(array, observer.elements));
+
+            array.update(array.begin(), 1200);
+            Assert::IsTrue(equals(array, observer.elements));
+
+            {
+                undo_redo_vector<int>::transaction transaction(array);
+                array.push_back(300);
+                array.erase(array.begin());
+            }
+            Assert::IsTrue(equals(array, observer.elements));
+
+            while (array.undo())
+                Assert::IsTrue(equals(array, observer.elements));
+            while (array.redo())
+                Assert::IsTrue(equals(array, observer.elements));
+
+            Assert::IsTrue(array.remove_observer(observer));
+            Assert::IsFalse(array.remove_observer(observer));
+            array.push_back(500);
+            Assert::AreEqual<size_t>(observer.elements.size(), array.size() - 1);
+        }
+
+        static void assert_indices(undo_redo_vector<int>& array, shos::index_map<int>& indices)
+        {
+            for (size_t index = 0; index < array.size(); index++) {
+                size_t found;
+                Assert::IsTrue(indices.find(array[index], found));
+                Assert::AreEqual<size_t>(found, index);
+            }
+        }
+
+        TEST_METHOD(index_of_element)
+        {
+            undo_redo_vector<int> array;
+            shos::index_map<int>  indices(array);
+
+            array.push_back(100);
+            array.push_back(200);
+            array.push_back(300);
+            array.push_back(400);
+            assert_indices(array, indices);
+
+            array.erase(std::next(array.begin(), 1));
+            assert_indices(array, indices);
+
+            size_t found;
+            Assert::IsFalse(indices.find(200, found));
+
+            array.update(std::next(array.begin(), 2), 1400);
+            assert_indices(array, indices);
+            Assert::IsFalse(indices.find(400, found));
+
+            {
+                undo_redo_vector<int>::transaction transaction(array);
+                array.erase(array.begin());
+                array.push_back(500);
+            }
+            assert_indices(array, indices);
+
+            while (array.undo())
+                assert_indices(array, indices);
+            while (array.redo())
+                assert_indices(array, indices);
+            Assert::IsFalse(indices.find(100, found));
+        }
+
+        TEST_METHOD(index_of_element_after_repair)
+        {
+            const int             count = 10000;
+            undo_redo_vector<int> array;
+            for (int element = 0; element < count; element++)
+                array.push_back(element);
+
+            // The map starts empty beside a large collection, so the repair on the first lookup grows it.
+            shos::index_map<int>  indices(array);
+            array.push_back(count);
+
+            size_t found;
+            Assert::IsTrue(indices.find(count, found));
+            Assert::AreEqual<size_t>(found, count);
+            assert_indices(array, indices);
+
+            array.erase(array.begin());
+            Assert::IsTrue(indices.find(count, found));
+            Assert::AreEqual<size_t>(found, count - 1);
+            assert_indices(array, indices);
+        }
+
+        TEST_METHOD(bulk_erase_and_insert)
+        {
+            undo_redo_vector<int> array;
+            element_observer      observer;
+            array.add_observer(observer);
+            shos::index_map<int>  indices(array);
+
+            for (int element = 0; element < 8; element++)
+                array.push_back(element * 100);
+
+            array.erase(std::vector<size_t>{ 6, 0, 3, 4 });
+            Assert::IsTrue(equals(array, { 100, 200, 500, 700 }));
+            Assert::IsTrue(equals(array, observer.elements));
+            assert_indices(array, indices);
+
+            array.insert({ 0, 2, 5 }, { 1000, 1100, 1200 });
+            Assert::IsTrue(equals(array, { 1000, 100, 1100, 200, 500, 1200, 700 }));
+            Assert::IsTrue(equals(array, observer.elements));
+            assert_indices(array, indices);
+
+            array.append({ 1300, 1400 });
+            Assert::IsTrue(equals(array, { 1000, 100, 1100, 200, 500, 1200, 700, 1300, 1400 }));
+
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(equals(array, { 100, 200, 500, 700 }));
+            Assert::IsTrue(equals(array, observer.elements));
+            assert_indices(array, indices);
+
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(equals(array, { 0, 100, 200, 300, 400, 500, 600, 700 }));
+            Assert::IsTrue(equals(array, observer.elements));
+            assert_indices(array, indices);
+
+            while (array.redo())
+                Assert::IsTrue(equals(array, observer.elements));
+            Assert::AreEqual<size_t>(array.size(), 9UL);
+            assert_indices(array, indices);
+
+            Assert::ExpectException<std::out_of_range>([&] { array.erase(std::vector<size_t>{ 9 }); });
+            Assert::ExpectException<std::invalid_argument>([&] { array.erase(std::vector<size_t>{ 1, 1 }); });
+            Assert::ExpectException<std::invalid_argument>([&] { array.insert({ 2, 1 }, { 0, 0 }); });
+            Assert::AreEqual<size_t>(array.size(), 9UL);
+        }
+
+        TEST_METHOD(chunked_collection)
+        {
+            undo_redo_collection<int, chunked_vector<int, 4>> array;
+            for (int element = 0; element < 40; element++)
+                array.push_back(element);
+
+            array.erase(std::next(array.begin(), 17));
+            array.erase(std::vector<size_t> { 0, 5, 6, 7, 8, 9, 30 });
+            array.insert({ 1, 2, 3 }, { 100, 200, 300 });
+            array.update(std::next(array.begin(), 20), 400);
+            Assert::AreEqual<std::size_t>(35, array.size());
+            Assert::AreEqual(1, array[0]);
+            Assert::AreEqual(100, array[1]);
+            Assert::AreEqual(400, array[20]);
+
+            while (array.undo())
+                ;
+            Assert::AreEqual<std::size_t>(0, array.size());
+            while (array.redo())
+                ;
+            Assert::AreEqual<std::size_t>(35, array.size());
+            Assert::AreEqual(400, array[20]);
+            Assert::AreEqual(39, array[34]);
+        }
+
+        TEST_METHOD(move_only_elements)
+        {
+            undo_redo_collection<std::unique_ptr<int>, std::vector<std::unique_ptr<int>>, null_disposer> array;
+            array.emplace_back(new int(100));
+            array.push_back(std::unique_ptr<int>(new int(200)));
+            array.emplace_update(array.begin(), new int(300));
+            array.erase(std::next(array.begin()));
+            Assert::AreEqual<std::size_t>(1, array.size());
+            Assert::AreEqual(300, *array[0]);
+
+            array.undo();
+            Assert::AreEqual(200, *array[1]);
+            array.undo();
+            Assert::AreEqual(100, *array[0]);
+            while (array.undo())
+                ;
+            Assert::AreEqual<std::size_t>(0, array.size());
+            while (array.redo())
+                ;
+            Assert::AreEqual<std::size_t>(1, array.size());
+            Assert::AreEqual(300, *array[0]);
+
+            std::vector<std::unique_ptr<int>> elements;
+            elements.emplace_back(new int(400));
+            elements.emplace_back(new int(500));
+            array.append(std::move(elements));
+            array.erase(std::vector<size_t> { 0, 2 });
+            Assert::AreEqual(400, *array[0]);
+            array.undo();
+            Assert::AreEqual(500, *array[2]);
+
+            Assert::ExpectException<std::logic_error>([&] { array.set_checkpoint_interval(4); });
+        }
+
+        TEST_METHOD(memory_range_path)
+        {
+            undo_redo_collection<int, std::vector<int>> fast;
+            undo_redo_collection<int, std::list<int>>   generic;
+            element_observer                            fast_observer;
+            element_observer                            generic_observer;
+            fast   .add_observer(fast_observer   );
+            generic.add_observer(generic_observer);
+
+            unsigned int random = 7;
+            auto next = [&] { random = random * 1103515245 + 12345; return random >> 8; };
+            for (int element = 0; element < 64; element++) {
+                fast   .push_back(element);
+                generic.push_back(element);
+            }
+            for (int count = 0; count < 300; count++) {
+                switch (next() % 4) {
+                case 0:
+                    {
+                        std::vector<std::size_t> indices;
+                        for (std::size_t index = 0; index < fast.size(); index++) {
+                            if (next() % 3 == 0)
+                                indices.push_back(index);
+                        }
+                        fast   .erase(indices);
+                        generic.erase(indices);
+                    }
+                    break;
+                case 1:
+                    {
+                        std::vector<std::size_t> indices;
+                        std::vector<int>         elements;
+                        for (std::size_t index = 0; index < fast.size() + indices.size() + 1; index++) {
+                            if (next() % 3 == 0) {
+                                indices .push_back(index);
+                                elements.push_back(1000 + count);
+                            }
+                        }
+                        fast   .insert(indices, elements);
+                        generic.insert(indices, elements);
+                    }
+                    break;
+                case 2:
+                    Assert::AreEqual(generic.undo(), fast.undo());
+                    break;
+                default:
+                    Assert::AreEqual(generic.redo(), fast.redo());
+                    break;
+                }
+                Assert::IsTrue(std::equal(fast.cbegin(), fast.cend(), generic.cbegin(), generic.cend()));
+                Assert::IsTrue(fast_observer.elements == generic_observer.elements);
+                Assert::IsTrue(equals(fast, fast_observer.elements));
+            }
+        }
+
         class foo
         {
             int value;
@@ -369,6 +733,386 @@ namespace ShosMiniCadSampleTest
         }
 
 
+        TEST_METHOD(history_limit)
+        {
+            auto cleanedUpCount = 0;
+            undo_redo_vector<int> array([&](int) { cleanedUpCount++; });
+
+            array.set_history_limit(3);
+            for (auto value = 0; value < 5; value++)
+                array.push_back(value);
+            Assert::AreEqual(size_t(3), array.history_size());
+
+            array.erase(array.begin());
+            array.update(array.begin(), 100);
+            Assert::AreEqual(size_t(3), array.history_size());
+            Assert::AreEqual(0, cleanedUpCount);
+
+            array.push_back(5);
+            Assert::AreEqual(0, cleanedUpCount);
+            array.push_back(6);
+            Assert::AreEqual(1, cleanedUpCount);
+
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(array.undo());
+            Assert::IsFalse(array.undo());
+            Assert::AreEqual(size_t(4), array.size());
+            Assert::AreEqual(1, array[0]);
+
+            auto bytes = array.history_bytes();
+            Assert::IsTrue(bytes > 0);
+            array.set_history_limit(0, 1);
+            Assert::AreEqual(size_t(3), array.history_size());
+            Assert::AreEqual(bytes, array.history_bytes());
+
+            array.redo();
+            array.set_history_limit(0, 1);
+            Assert::AreEqual(size_t(2), array.history_size());
+            Assert::AreEqual(2, cleanedUpCount);
+            Assert::IsFalse(array.undo());
+
+            array.push_back(7);
+            Assert::AreEqual(size_t(1), array.history_size());
+            Assert::AreEqual(4, cleanedUpCount);
+
+            array.reset();
+            Assert::AreEqual(size_t(0), array.history_bytes());
+        }
+
+        TEST_METHOD(clear_history)
+        {
+            auto cleanedUpCount = 0;
+            undo_redo_vector<int> array([&](int) { cleanedUpCount++; });
+            array.set_checkpoint_interval(1);
+            array.append({ 0, 1, 2 });
+            array.erase(array.begin());
+            Assert::AreEqual(size_t(2), array.history_size());
+
+            array.clear_history();
+            Assert::AreEqual(size_t(0), array.history_size());
+            Assert::AreEqual(size_t(0), array.history_bytes());
+            Assert::AreEqual(1, cleanedUpCount);
+            Assert::IsFalse(array.undo());
+            Assert::AreEqual(size_t(2), array.size());
+            Assert::AreEqual(1, array[0]);
+
+            array.push_back(3);
+            Assert::IsTrue(array.undo());
+            Assert::AreEqual(size_t(2), array.size());
+            Assert::IsFalse(array.undo());
+        }
+
+        struct counting_disposer
+        {
+            int* count;
+
+            bool enabled() const
+            {
+                return true;
+            }
+
+            void operator()(int /* element */) const
+            {
+                (*count)++;
+            }
+        };
+
+        TEST_METHOD(disposer_policy)
+        {
+            auto disposedCount = 0;
+            {
+                undo_redo_collection<int, std::vector<int>, counting_disposer> array(counting_disposer { &disposedCount });
+                array.push_back(100);
+                array.push_back(200);
+                array.update(array.begin(), 300);
+                array.erase(std::vector<size_t> { 0, 1 });
+                Assert::AreEqual(0, disposedCount);
+
+                array.undo();
+                array.undo();
+                array.push_back(400);
+                Assert::AreEqual(1, disposedCount);
+            }
+            Assert::AreEqual(4, disposedCount);
+
+            undo_redo_collection<int, std::vector<int>, null_disposer> array;
+            array.push_back(100);
+            array.erase(array.begin());
+            array.reset();
+            Assert::AreEqual(size_t(0), array.size());
+        }
+
+        TEST_METHOD(jump_to)
+        {
+            undo_redo_vector<int> array;
+            array.set_checkpoint_interval(4);
+            for (auto value = 0; value < 20; value++) {
+                array.push_back(value);
+                if (value % 5 == 4)
+                    array.erase(array.begin());
+            }
+            array.update(array.begin(), 100);
+            Assert::AreEqual(size_t(25), array.history_size());
+
+            Assert::IsTrue(array.jump_to(3));
+            Assert::AreEqual(size_t(3), array.history_position());
+            Assert::AreEqual(size_t(3), array.size());
+            Assert::AreEqual(2, array[2]);
+
+            Assert::IsTrue(array.jump_to(6));
+            Assert::AreEqual(size_t(4), array.size());
+            Assert::AreEqual(1, array[0]);
+
+            Assert::IsTrue(array.jump_to(25));
+            Assert::AreEqual(size_t(16), array.size());
+            Assert::AreEqual(100, array[0]);
+            Assert::IsFalse(array.jump_to(25));
+
+            Assert::IsTrue(array.undo());
+            Assert::AreEqual(4, array[0]);
+            Assert::IsTrue(array.jump_to(0));
+            Assert::AreEqual(size_t(0), array.size());
+            Assert::IsTrue(array.redo());
+            Assert::AreEqual(0, array[0]);
+        }
+
+        class memory_spiller : public history_spiller<int>
+        {
+            std::map<size_t, std::vector<int>> spilled;
+            size_t                             next_key = 0;
+
+        public:
+            bool                               is_failing = false;
+
+            size_t size() const
+            {
+                return spilled.size();
+            }
+
+            virtual size_t spill(std::vector<int> elements) override
+            {
+                spilled[next_key] = elements;
+                return next_key++;
+            }
+
+            virtual std::vector<int> restore(size_t key) override
+            {
+                if (is_failing)
+                    throw std::runtime_error("cannot restore");
+                auto elements = spilled[key];
+                spilled.erase(key);
+                return elements;
+            }
+
+            virtual void discard(size_t key) override
+            {
+                spilled.erase(key);
+            }
+        };
+
+        TEST_METHOD(coalesce_updates)
+        {
+            auto disposedCount = 0;
+            undo_redo_collection<int, std::vector<int>, counting_disposer> array(counting_disposer { &disposedCount });
+            array.push_back(10);
+            array.push_back(20);
+            for (auto value = 11; value <= 13; value++) {
+                undo_redo_collection<int, std::vector<int>, counting_disposer>::coalescing coalescing(array);
+                array.update(array.begin(), value);
+            }
+            Assert::AreEqual(size_t(3), array.history_size());
+            Assert::AreEqual(2, disposedCount);
+            Assert::AreEqual(13, array[0]);
+
+            {
+                undo_redo_collection<int, std::vector<int>, counting_disposer>::coalescing coalescing(array);
+                array.update(std::next(array.begin()), 21);
+            }
+            Assert::AreEqual(size_t(4), array.history_size());
+
+            array.break_coalescing();
+            {
+                undo_redo_collection<int, std::vector<int>, counting_disposer>::coalescing coalescing(array);
+                array.update(std::next(array.begin()), 22);
+            }
+            Assert::AreEqual(size_t(5), array.history_size());
+
+            array.undo();
+            array.undo();
+            Assert::AreEqual(13, array[0]);
+            Assert::AreEqual(20, array[1]);
+            array.undo();
+            Assert::AreEqual(10, array[0]);
+            array.redo();
+            Assert::AreEqual(13, array[0]);
+            Assert::AreEqual(2, disposedCount);
+        }
+
+        class value_patch : public element_patch<int>
+        {
+            std::vector<int> values;
+
+        public:
+            value_patch(std::vector<int> values) : values(values)
+            {}
+
+            virtual void exchange(size_t offset, int& element) override
+            {
+                std::swap(values[offset], element);
+            }
+
+            virtual size_t footprint() const override
+            {
+                return values.size() * sizeof(int);
+            }
+
+            virtual bool covers(const element_patch<int>& /* newer */) const override
+            {
+                return true;
+            }
+        };
+
+        TEST_METHOD(patch_elements)
+        {
+            undo_redo_vector<int> array;
+            element_observer      observer;
+            array.add_observer(observer);
+            array.set_checkpoint_interval(2);
+            for (auto value = 0; value < 5; value++)
+                array.push_back(value);
+
+            array.patch({ 1, 3 }, std::unique_ptr<value_patch>(new value_patch({ 10, 30 })));
+            Assert::AreEqual(size_t(6), array.history_size());
+            Assert::AreEqual(10, array[1]);
+            Assert::AreEqual(30, array[3]);
+            Assert::IsTrue(equals(array, observer.elements));
+
+            array.undo();
+            Assert::AreEqual(1, array[1]);
+            Assert::AreEqual(3, array[3]);
+            Assert::IsTrue(equals(array, observer.elements));
+            array.redo();
+            Assert::AreEqual(10, array[1]);
+
+            for (auto value = 11; value <= 13; value++) {
+                undo_redo_vector<int>::coalescing coalescing(array);
+                array.patch({ 1, 3 }, std::unique_ptr<value_patch>(new value_patch({ value, value + 20 })));
+            }
+            Assert::AreEqual(size_t(7), array.history_size());
+            Assert::AreEqual(33, array[3]);
+            array.undo();
+            Assert::AreEqual(10, array[1]);
+            Assert::AreEqual(30, array[3]);
+
+            Assert::IsTrue(array.jump_to(0));
+            Assert::AreEqual(size_t(0), array.size());
+            Assert::IsTrue(array.jump_to(7));
+            Assert::AreEqual(13, array[1]);
+            Assert::AreEqual(33, array[3]);
+
+            Assert::ExpectException<std::invalid_argument>([&] { array.patch({ 3, 1 }, std::unique_ptr<value_patch>(new value_patch({ 0, 0 }))); });
+            Assert::ExpectException<std::out_of_range>([&] { array.patch({ 5 }, std::unique_ptr<value_patch>(new value_patch({ 0 }))); });
+        }
+
+        TEST_METHOD(spill_history)
+        {
+            memory_spiller spiller;
+            {
+                undo_redo_vector<int> array;
+                array.set_spiller(&spiller, 1);
+                for (auto value = 0; value < 4; value++)
+                    array.push_back(value);
+                array.update(array.begin(), 100);
+                array.erase(array.begin() + 1);
+                array.push_back(4);
+                Assert::AreEqual(size_t(2), spiller.size());
+
+                Assert::IsTrue(array.undo());
+                Assert::IsTrue(array.undo());
+                Assert::IsTrue(array.undo());
+                Assert::AreEqual(size_t(0), spiller.size());
+                Assert::AreEqual(0, array[0]);
+                Assert::AreEqual(1, array[1]);
+
+                Assert::IsTrue(array.redo());
+                Assert::IsTrue(array.redo());
+                Assert::IsTrue(array.redo());
+                Assert::AreEqual(size_t(2), spiller.size());
+                Assert::AreEqual(100, array[0]);
+                Assert::AreEqual(2, array[1]);
+
+                // a step that cannot be restored leaves the collection as it was
+                spiller.is_failing = true;
+                Assert::ExpectException<std::runtime_error>([&] { array.jump_to(0); });
+                Assert::AreEqual(size_t(7), array.history_position());
+                Assert::IsTrue(equals(array, { 100, 2, 3, 4 }));
+                Assert::IsTrue(array.undo());
+                Assert::ExpectException<std::runtime_error>([&] { array.undo(); });
+                Assert::AreEqual(size_t(6), array.history_position());
+                Assert::IsTrue(equals(array, { 100, 2, 3 }));
+                Assert::AreEqual(size_t(2), spiller.size());
+
+                spiller.is_failing = false;
+                Assert::IsTrue(array.undo());
+                Assert::IsTrue(equals(array, { 100, 1, 2, 3 }));
+            }
+            Assert::AreEqual(size_t(0), spiller.size());
+        }
+
+        // Gives back other elements than it took, as a spiller that rebuilds objects does.
+        class renewing_spiller : public history_spiller<int>
+        {
+            std::map<size_t, std::vector<int>> spilled;
+            size_t                             next_key = 0;
+
+        public:
+            virtual size_t spill(std::vector<int> elements) override
+            {
+                spilled[next_key] = elements;
+                return next_key++;
+            }
+
+            virtual std::vector<int> restore(size_t key) override
+            {
+                auto elements = spilled[key];
+                spilled.erase(key);
+                for (auto& element : elements)
+                    element += 1000;
+                return elements;
+            }
+
+            virtual void discard(size_t key) override
+            {
+                spilled.erase(key);
+            }
+        };
+
+        TEST_METHOD(spill_history_with_checkpoints)
+        {
+            renewing_spiller      spiller;
+            undo_redo_vector<int> array;
+            array.set_checkpoint_interval(2);
+            array.set_spiller(&spiller, 1);
+            for (auto value = 0; value < 4; value++)
+                array.push_back(value);
+            array.erase(array.begin() + 1);
+            array.push_back(4);
+
+            Assert::IsTrue(array.jump_to(1));
+            Assert::AreEqual(size_t(1), array.size());
+            Assert::IsTrue(array.jump_to(2));
+            Assert::AreEqual(1001, array[1]);
+            Assert::IsTrue(array.jump_to(4));
+            Assert::AreEqual(1001, array[1]);
+            Assert::AreEqual(3, array[3]);
+
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(array.undo());
+            Assert::IsTrue(array.redo());
+            Assert::AreEqual(1001, array[1]);
+        }
+
         TEST_METHOD(pointer_vector)
         {
             undo_redo_pointer_vector<foo> array;
@@ -393,5 +1137,233 @@ namespace ShosMiniCadSampleTest
             array.redo();
             array.redo();
         }
+
+        struct bounds
+        {
+            long left, top, right, bottom;
+
+            bool operator ==(const bounds& another) const
+            {
+                return left == another.left && top == another.top && right == another.right && bottom == another.bottom;
+            }
+        };
+
+        // A figure-like element: its area is the square inflated by the pen width, cached as Figure caches its own.
+        class square
+        {
+            long                            x, y, size;
+            int                             pen_width;
+            mutable area_cache<bounds, int> cache;
+
+        public:
+            square(long x, long y, long size, int pen_width) : x(x), y(y), size(size), pen_width(pen_width)
+            {}
+
+            int& width()
+            {
+                return pen_width;
+            }
+
+            void move(long dx, long dy)
+            {
+                x += dx;
+                y += dy;
+                cache.invalidate();
+            }
+
+            bounds get_area() const
+            {
+                return cache.get(pen_width, [this] { return get_shape_area(); }, &inflate);
+            }
+
+            bounds compute_area() const
+            {
+                return inflate(get_shape_area(), pen_width);
+            }
+
+        private:
+            bounds get_shape_area() const
+            {
+                return bounds { x, y, x + size, y + size };
+            }
+
+            static bounds inflate(bounds area, int margin)
+            {
+                return bounds { area.left - margin, area.top - margin, area.right + margin, area.bottom + margin };
+            }
+        };
+
+        // Sets pen widths in place, as FigureAttributePatch sets attributes.
+        class pen_width_patch : public element_patch<square*>
+        {
+            std::vector<int> widths;
+
+        public:
+            pen_width_patch(std::vector<int> widths) : widths(widths)
+            {}
+
+            virtual void exchange(size_t offset, square*& element) override
+            {
+                std::swap(widths[offset], element->width());
+            }
+
+            virtual size_t footprint() const override
+            {
+                return widths.size() * sizeof(int);
+            }
+        };
+
+        // Moves the elements in place, and back again on the next application.
+        class move_patch : public element_patch<square*>
+        {
+            long   dx, dy;
+            size_t count;
+
+        public:
+            move_patch(long dx, long dy, size_t count) : dx(dx), dy(dy), count(count)
+            {}
+
+            virtual void exchange(size_t offset, square*& element) override
+            {
+                element->move(dx, dy);
+                if (offset + 1 == count) {
+                    dx = -dx;
+                    dy = -dy;
+                }
+            }
+
+            virtual size_t footprint() const override
+            {
+                return sizeof(*this);
+            }
+        };
+
+        static void assert_areas(undo_redo_pointer_vector<square>& array)
+        {
+            for (auto element : array)
+                Assert::IsTrue(element->get_area() == element->compute_area());
+        }
+
+        TEST_METHOD(cached_area)
+        {
+            undo_redo_pointer_vector<square> array;
+            for (long index = 0; index < 3; index++)
+                array.push_back(new square(index * 100, index * 50, 10 + index, 1));
+            assert_areas(array);
+
+            auto moved = new square(*array[1]);
+            moved->move(30, -20);
+            array.update(array.begin() + 1, moved);
+            assert_areas(array);
+            Assert::IsTrue(array[1]->get_area() == bounds { 129, 29, 142, 42 });
+            Assert::IsTrue(array.undo());
+            assert_areas(array);
+            Assert::IsTrue(array[1]->get_area() == bounds { 99, 49, 112, 62 });
+            Assert::IsTrue(array.redo());
+            assert_areas(array);
+
+            array.patch({ 0, 2 }, std::unique_ptr<pen_width_patch>(new pen_width_patch({ 5, 7 })));
+            assert_areas(array);
+            Assert::IsTrue(array[2]->get_area() == bounds { 193, 93, 219, 119 });
+            Assert::IsTrue(array.undo());
+            assert_areas(array);
+            Assert::IsTrue(array[2]->get_area() == bounds { 199, 99, 213, 113 });
+            Assert::IsTrue(array.redo());
+            assert_areas(array);
+
+            array.patch({ 0, 1 }, std::unique_ptr<move_patch>(new move_patch(5, 5, 2)));
+            assert_areas(array);
+            Assert::IsTrue(array[0]->get_area() == bounds { 0, 0, 20, 20 });
+            Assert::IsTrue(array.undo());
+            assert_areas(array);
+            Assert::IsTrue(array[0]->get_area() == bounds { -5, -5, 15, 15 });
+
+            Assert::IsTrue(array.jump_to(3));
+            assert_areas(array);
+            Assert::IsTrue(array.jump_to(6));
+            assert_areas(array);
+        }
+
+        using small_pool = size_class_pool<16, 4, 1024, 8>;
+
+        TEST_METHOD(pool_blocks)
+        {
+            small_pool pool;
+            std::vector<long long*> blocks;
+            for (long long index = 0; index < 1000; index++) {
+                auto block = static_cast<long long*>(pool.allocate(index % 64 + 1));
+                *block = index;
+                blocks.push_back(block);
+            }
+            Assert::AreEqual<std::size_t>(1000, pool.live_count());
+            for (long long index = 0; index < 1000; index++)
+                Assert::AreEqual(index, *blocks[index]);
+
+            auto large = pool.allocate(100);
+            Assert::AreEqual<std::size_t>(1000, pool.live_count());
+            pool.deallocate(large, 100);
+
+            for (std::size_t index = 0; index < 1000; index += 2)
+                pool.deallocate(blocks[index], index % 64 + 1);
+            Assert::AreEqual<std::size_t>(500, pool.live_count());
+            pool.trim();
+            for (std::size_t index = 1; index < 1000; index += 2)
+                Assert::AreEqual(static_cast<long long>(index), *blocks[index]);
+
+            auto block = pool.allocate(10);
+            pool.deallocate(block, 10);
+            Assert::IsTrue(block == pool.allocate(16));
+
+            pool.deallocate(block, 16);
+            for (std::size_t index = 1; index < 1000; index += 2)
+                pool.deallocate(blocks[index], index % 64 + 1);
+            Assert::AreEqual<std::size_t>(0, pool.live_count());
+            pool.trim();
+            pool.deallocate(pool.allocate(20), 20);
+            Assert::AreEqual<std::size_t>(0, pool.live_count());
+        }
+
+        TEST_METHOD(pool_threads)
+        {
+            const std::size_t thread_count = 4;
+            const std::size_t block_count  = 5000;
+
+            std::vector<std::vector<std::size_t*>> blocks(thread_count);
+            {
+                small_pool pool;
+                std::vector<std::thread> threads;
+                for (std::size_t thread = 0; thread < thread_count; thread++) {
+                    threads.push_back(std::thread([&, thread] {
+                        for (std::size_t index = 0; index < block_count; index++) {
+                            auto block = static_cast<std::size_t*>(pool.allocate(sizeof(std::size_t) * (index % 4 + 1)));
+                            *block = thread;
+                            blocks[thread].push_back(block);
+                        }
+                        // frees half of its blocks and leaves the rest to another thread
+                        for (std::size_t index = 0; index < block_count; index += 2)
+                            pool.deallocate(blocks[thread][index], sizeof(std::size_t) * (index % 4 + 1));
+                    }));
+                }
+                for (auto& thread : threads)
+                    thread.join();
+                Assert::AreEqual<std::size_t>(thread_count * block_count / 2, pool.live_count());
+
+                for (std::size_t thread = 0; thread < thread_count; thread++) {
+                    for (std::size_t index = 1; index < block_count; index += 2) {
+                        Assert::AreEqual(thread, *blocks[thread][index]);
+                        pool.deallocate(blocks[thread][index], sizeof(std::size_t) * (index % 4 + 1));
+                    }
+                }
+                Assert::AreEqual<std::size_t>(0, pool.live_count());
+                pool.trim();
+            }
+
+            // a pool made after another one is gone does not see the blocks this thread kept for that one
+            small_pool pool;
+            Assert::AreEqual<std::size_t>(0, pool.live_count());
+            auto block = pool.allocate(8);
+            Assert::AreEqual<std::size_t>(1, pool.live_count());
+            pool.deallocate(block, 8);
+        }
     };
 }
@@ -48,13 +48,29 @@ public:
     Cursor() : cursorPositionExists(false)
     {}
 
-    void Draw(CDC& dc, const MessageHolder& messageHolder)
+    void Draw(CDC& dc, GdiObjectCache& gdiObjectCache, const MessageHolder& messageHolder)
     {
         if (!cursorPositionExists)
             return;
 
-        DrawCursor(dc, cursorPosition);
-        DrawMessage(dc, cursorPosition, messageHolder);
+        DrawCursor(dc, gdiObjectCache, cursorPosition);
+        DrawMessage(dc, gdiObjectCache, cursorPosition, messageHolder);
+    }
+
+    // The bounds of what Draw draws, in device coordinates.
+    CRect GetArea(CDC& dc, GdiObjectCache& gdiObjectCache, const MessageHolder& messageHolder) const
+    {
+        if (!cursorPositionExists)
+            return CRect();
+
+        auto deviceCursorPosition = cursorPosition;
+        dc.LPtoDP(&deviceCursorPosition);
+        CRect area(deviceCursorPosition, deviceCursorPosition);
+        auto  margin = cursorLength + Geometry::LPtoDP(dc, cursorPenWidth) + 1;
+        area.InflateRect(margin, margin);
+
+        area.UnionRect(area, GetMessageArea(dc, gdiObjectCache, cursorPosition, messageHolder));
+        return area;
     }
 
     void SetCursorPosition(CPoint point)
@@ -64,10 +80,9 @@ public:
     }
 
 private:
-    static void DrawCursor(CDC& dc, CPoint cursorPosition)
+    static void DrawCursor(CDC& dc, GdiObjectCache& gdiObjectCache, CPoint cursorPosition)
     {
-        CPen pen(PS_SOLID, cursorPenWidth, cursorColor);
-        GdiObjectSelector penSelector(dc, pen);
+        GdiObjectSelector penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, cursorPenWidth, cursorColor));
 
         auto deviceCursorPosition = cursorPosition;
         dc.LPtoDP(&deviceCursorPosition);
@@ -84,15 +99,12 @@ private:
         dc.Polyline(points + 2, sizeof(points) / sizeof(CPoint) / 2);
     }
 
-    static void DrawMessage(CDC& dc, CPoint cursorPosition, const MessageHolder& messageHolder)
+    static void DrawMessage(CDC& dc, GdiObjectCache& gdiObjectCache, CPoint cursorPosition, const MessageHolder& messageHolder)
     {
         auto dcId = dc.SaveDC();
 
         auto logicalMessageTextSize = Geometry::DPtoLP(dc, messageTextSize);
-        
-        CFont   font;
-        CreateMessageFont(font, logicalMessageTextSize);
-        dc.SelectObject(&font);
+        dc.SelectObject(&GetMessageFont(gdiObjectCache, logicalMessageTextSize));
 
         dc.SetTextColor(cursorColor);
         dc.SetBkMode(TRANSPARENT);
@@ -103,7 +115,24 @@ private:
         dc.RestoreDC(dcId);
     }
 
-    static void CreateMessageFont(CFont& font, int textSize)
+    static CRect GetMessageArea(CDC& dc, GdiObjectCache& gdiObjectCache, CPoint cursorPosition, const MessageHolder& messageHolder)
+    {
+        auto dcId = dc.SaveDC();
+
+        auto logicalMessageTextSize = Geometry::DPtoLP(dc, messageTextSize);
+        dc.SelectObject(&GetMessageFont(gdiObjectCache, logicalMessageTextSize));
+
+        auto  logicalMessageMargin = Geometry::DPtoLP(dc, messageMargin);
+        CRect area(CPoint(cursorPosition.x + logicalMessageMargin, cursorPosition.y - logicalMessageTextSize - logicalMessageMargin), dc.GetTextExtent(messageHolder.GetTextline()));
+        dc.LPtoDP(&area);
+        area.NormalizeRect();
+        area.InflateRect(1, 1);
+
+        dc.RestoreDC(dcId);
+        return area;
+    }
+
+    static CFont& GetMessageFont(GdiObjectCache& gdiObjectCache, int textSize)
     {
         LOGFONT logFont;
         ::ZeroMemory(&logFont, sizeof(logFont));
@@ -115,7 +144,7 @@ private:
         logFont.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
         lstrcpy(logFont.lfFaceName, _T("Arial"));
 
-        font.CreateFontIndirect(&logFont);
+        return gdiObjectCache.GetFont(logFont);
     }
 };
 
@@ -140,10 +169,18 @@ public:
         model = &newModel;
     }
 
-    void Draw(CDC& dc)
+    void Draw(CDC& dc, GdiObjectCache& gdiObjectCache)
     {
-        cursor.Draw(dc, *this);
-        OnDraw(dc);
+        cursor.Draw(dc, gdiObjectCache, *this);
+        OnDraw(dc, gdiObjectCache);
+    }
+
+    // The bounds of what Draw draws, in device coordinates, so that a change repaints no more than them.
+    CRect GetArea(CDC& dc, GdiObjectCache& gdiObjectCache)
+    {
+        CRect area;
+        area.UnionRect(cursor.GetArea(dc, gdiObjectCache, *this), OnGetArea(dc));
+        return area;
     }
 
     virtual void OnDragStart(UINT keys, CPoint point) override
@@ -176,9 +213,25 @@ public:
     }
 
 protected:
-    virtual void OnDraw(CDC& /* dc */)
+    virtual void OnDraw(CDC& /* dc */, GdiObjectCache& /* gdiObjectCache */)
     {}
 
+    virtual CRect OnGetArea(CDC& /* dc */)
+    {
+        return CRect();
+    }
+
+    // A logical area drawn with a pen of the width, in device coordinates.
+    static CRect GetDeviceArea(CDC& dc, CRect area, int penWidth)
+    {
+        area.NormalizeRect();
+        area.InflateRect(penWidth, penWidth);
+        dc.LPtoDP(&area);
+        area.NormalizeRect();
+        area.InflateRect(1, 1);
+        return area;
+    }
+
     virtual void OnInput(CPoint /* point */)
     {}
 
@@ -204,6 +257,7 @@ class SelectCommand : public Command
 
     static const COLORREF areaPenColor      = RGB(0x40, 0x60, 0x80);
     static const COLORREF areaBrushColor    = RGB(0x20, 0x30, 0x40);
+    static const int      hilightPenWidth   = 3;
 
     bool              hasDistanceToFigure;
     long              distanceToFigure;
@@ -217,12 +271,22 @@ public:
     {}
 
 protected:
-    virtual void OnDraw(CDC& dc) override
+    virtual void OnDraw(CDC& dc, GdiObjectCache& gdiObjectCache) override
     {
         if (GetModel().Hilight() != nullptr)
-            GetModel().Hilight()->DrawArea(dc);
+            GetModel().Hilight()->DrawArea(dc, gdiObjectCache);
+
+        DrawArea(dc, gdiObjectCache);
+    }
 
-        DrawArea(dc);
+    virtual CRect OnGetArea(CDC& dc) override
+    {
+        CRect drawingArea;
+        if (GetModel().Hilight() != nullptr)
+            drawingArea = GetDeviceArea(dc, GetModel().Hilight()->GetArea(), hilightPenWidth);
+        if (isAreaValid)
+            drawingArea.UnionRect(drawingArea, GetDeviceArea(dc, area, 0));
+        return drawingArea;
     }
 
     virtual void OnInput(CPoint point) override
@@ -297,25 +361,7 @@ protected:
 private:
     Figure* GetNearestFigure(CPoint point, long* distance = nullptr)
     {
-        auto       minimumDistance = Geometry::maximumDistance;
-        Figure*    nearestFigure   = nullptr;
-
-        CRect      searchinRect(point, point);
-        searchinRect.InflateRect(searchingDistance, searchingDistance);
-        
-        for (auto figure : GetModel()) {
-            CRect rect;
-            if (rect.IntersectRect(figure->GetArea(), searchinRect)) {
-                auto figureDistance = figure->GetDistanceFrom(point);
-                if (figureDistance < minimumDistance) {
-                    minimumDistance = figureDistance;
-                    nearestFigure   = figure;
-                }
-            }
-        }
-        if (distance != nullptr)
-            *distance = nearestFigure == nullptr ? 0L : minimumDistance;
-        return nearestFigure;
+        return GetModel().GetNearestFigure(point, searchingDistance, distance);
     }
 
     void SetArea(CPoint point)
@@ -324,14 +370,11 @@ private:
         area.NormalizeRect();
     }
 
-    void DrawArea(CDC& dc) const
+    void DrawArea(CDC& dc, GdiObjectCache& gdiObjectCache) const
     {
         if (isAreaValid) {
-            CPen pen(PS_SOLID, 0, areaPenColor);
-            GdiObjectSelector penSelector(dc, pen);
-
-            CBrush brush(areaBrushColor);
-            GdiObjectSelector brushSelector(dc, brush);
+            GdiObjectSelector penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, 0, areaPenColor));
+            GdiObjectSelector brushSelector(dc, gdiObjectCache.GetBrush(areaBrushColor));
 
             auto rop = dc.SetROP2(R2_XORPEN);
             dc.Rectangle(&area);
@@ -352,15 +395,27 @@ public:
     {}
 
 protected:
-    virtual void OnDraw(CDC& dc) override
+    virtual void OnDraw(CDC& dc, GdiObjectCache& gdiObjectCache) override
     {
         if (GetCount() > 0) {
             auto figure = GetFigure(cursorPosition);
             if (figure == nullptr)
                 return;
             figure->Attribute() = GetModel().GetCurrentFigureAttribute();
-            figure->Draw(dc);
+            figure->Draw(dc, gdiObjectCache);
+        }
+    }
+
+    virtual CRect OnGetArea(CDC& dc) override
+    {
+        if (GetCount() > 0) {
+            auto figure = GetFigure(cursorPosition);
+            if (figure != nullptr) {
+                figure->Attribute() = GetModel().GetCurrentFigureAttribute();
+                return GetDeviceArea(dc, figure->GetArea(), 0);
+            }
         }
+        return CRect();
     }
 
     virtual void OnInput(CPoint point) override
@@ -581,10 +636,15 @@ public:
         currentCommand->Set(model);
     }
     
-    void Draw(CDC& dc)
+    void Draw(CDC& dc, GdiObjectCache& gdiObjectCache)
     {
         if (GetCurrentCommand() != nullptr)
-            GetCurrentCommand()->Draw(dc);
+            GetCurrentCommand()->Draw(dc, gdiObjectCache);
+    }
+
+    CRect GetArea(CDC& dc, GdiObjectCache& gdiObjectCache)
+    {
+        return GetCurrentCommand() == nullptr ? CRect() : GetCurrentCommand()->GetArea(dc, gdiObjectCache);
     }
 
     virtual void OnClick(CPoint point) override
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "Model.h"
+#include "FigureBatch.h"
 #include "Command.h"
 #include "MouseEventTranslator.h"
 
@@ -40,17 +41,24 @@ public:
         return model.end();
     }
 
+    Model::FigureRange FiguresIn(const CRect& area) const
+    {
+        return model.FiguresIn(area);
+    }
+
     void Add(Figure* figure)
     {
         model.Add(figure);
         SetModifiedFlag();
     }
 
-    void Draw(CDC& dc) const
+    void Draw(CDC& dc, GdiObjectCache& gdiObjectCache) const
     {
         DrawArea(dc);
+        FigureBatch batch(dc, gdiObjectCache);
         for (auto figure : *this)
-            figure->Draw(dc);
+            batch.Add(*figure);
+        batch.Flush();
     }
 
     void DrawArea(CDC& dc) const
@@ -58,9 +66,28 @@ public:
         dc.FillSolidRect(GetArea(), areaColor);
     }
 
-    void DrawCommand(CDC& dc)
+    // Draws the selector handles of the selected figures in the clip box.
+    // The figures come from the spatial index, so the cost follows the clip box rather than the size of the selection.
+    void DrawSelection(CDC& dc, GdiObjectCache& gdiObjectCache) const
+    {
+        CRect clipBox;
+        dc.GetClipBox(clipBox);
+        std::vector<const Figure*> figures;
+        for (auto figure : FiguresIn(clipBox)) {
+            if (figure->IsSelected())
+                figures.push_back(figure);
+        }
+        Figure::DrawSelecters(dc, gdiObjectCache, figures);
+    }
+
+    void DrawCommand(CDC& dc, GdiObjectCache& gdiObjectCache)
+    {
+        commandManager.Draw(dc, gdiObjectCache);
+    }
+
+    CRect GetCommandArea(CDC& dc, GdiObjectCache& gdiObjectCache)
     {
-        commandManager.Draw(dc);
+        return commandManager.GetArea(dc, gdiObjectCache);
     }
 
     void RemoveSelectedFigures()
@@ -108,7 +135,7 @@ public:
 protected:
     virtual void Update(const Hint& hint) override
     {
-        if (hint.type != Hint::Type::ViewOnly)
+        if (hint.type != Hint::Type::ViewOnly && hint.type != Hint::Type::Selected)
             SetModifiedFlag();
         UpdateAllViews(nullptr, 0, const_cast<Hint*>(&hint));
     }
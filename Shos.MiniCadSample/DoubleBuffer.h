@@ -1,14 +1,20 @@
 #pragma once
 
 #include <afx.h>
+#include <vector>
 #include "GdiObjectSelector.h"
 
 class DoubleBuffer
 {
-    bool     isCashValid;
-    CBitmap  cash;
-    COLORREF backgroundColor;
-    CView&   view;
+    // beyond this the damaged areas are merged into one
+    static const size_t maximumDamagedAreaCount = 64;
+
+    bool               isCashValid;
+    CBitmap            cash;
+    std::vector<CRect> damagedAreas;
+    CRect              layer2Area;
+    COLORREF           backgroundColor;
+    CView&             view;
 
 public:
     DoubleBuffer(CView& view) : isCashValid(false), backgroundColor(::GetSysColor(COLOR_WINDOW)), view(view)
@@ -54,17 +60,59 @@ protected:
     void Update()
     {
         isCashValid = false;
+        damagedAreas.clear();
+    }
+
+    // Redraws only the areas (in device coordinates) into the cache on the next paint, and invalidates them.
+    void Update(const std::vector<CRect>& areas)
+    {
+        Merge(damagedAreas, areas);
+        for (const auto& area : damagedAreas)
+            view.InvalidateRect(area);
+    }
+
+    // Invalidates the areas (in device coordinates) where only the overlay changed; the cache stays as it is.
+    void UpdateOverlay(const std::vector<CRect>& areas)
+    {
+        std::vector<CRect> invalidAreas;
+        Merge(invalidAreas, areas);
+        for (const auto& area : invalidAreas)
+            view.InvalidateRect(area);
+    }
+
+    // Invalidates where layer 2 was drawn and where it is to be drawn now, leaving the rest of the window alone.
+    void UpdateLayer2()
+    {
+        CClientDC dc(&view);
+        view.OnPrepareDC(&dc);
+        auto area = GetLayer2Area(dc);
+
+        CRect invalidArea;
+        invalidArea.UnionRect(layer2Area, area);
+        view.InvalidateRect(invalidArea);
+        layer2Area = area;
     }
 
     void Draw(CDC& dc)
     {
         DrawCash(dc);
         view.OnPrepareDC(&dc);
+        OnDrawOverlay(dc);
         OnDrawLayer2(dc);
     }
 
-    virtual void OnDrawLayer1(CDC& /* dc */) {}
-    virtual void OnDrawLayer2(CDC& /* dc */) {}
+    // Layer 1 is cached; the overlay and layer 2 above it are drawn on every paint.
+    virtual void OnDrawLayer1 (CDC& /* dc */) {}
+    virtual void OnDrawOverlay(CDC& /* dc */) {}
+    virtual void OnDrawLayer2 (CDC& /* dc */) {}
+
+    // The bounds of what OnDrawLayer2 draws, in device coordinates.
+    virtual CRect GetLayer2Area(CDC& /* dc */)
+    {
+        CRect clientRect;
+        view.GetClientRect(&clientRect);
+        return clientRect;
+    }
 
 private:
     void DrawCash(CDC& dc)
@@ -83,18 +131,68 @@ private:
         GdiObjectSelector selector(memoryDC, cash);
 
         if (!isCashValid) {
-            memoryDC.FillSolidRect(&clientRect, backgroundColor);
-            auto savedDC = memoryDC.SaveDC();
-            view.OnPrepareDC(&memoryDC);
-            OnDrawLayer1(memoryDC);
-            memoryDC.RestoreDC(savedDC);
+            DrawLayer1(memoryDC, clientRect);
             isCashValid = true;
+        } else {
+            for (const auto& area : damagedAreas) {
+                CRgn region;
+                region.CreateRectRgnIndirect(&area);
+                memoryDC.SelectClipRgn(&region);
+                DrawLayer1(memoryDC, area);
+            }
+            memoryDC.SelectClipRgn(nullptr);
         }
+        damagedAreas.clear();
 
         CRect clipBox;
         dc.GetClipBox(&clipBox);
         dc.BitBlt(clipBox.left, clipBox.top, clipBox.Width(), clipBox.Height(), &memoryDC, clipBox.left, clipBox.top, SRCCOPY);
     }
+
+    void DrawLayer1(CDC& memoryDC, const CRect& area)
+    {
+        memoryDC.FillSolidRect(&area, backgroundColor);
+        auto savedDC = memoryDC.SaveDC();
+        view.OnPrepareDC(&memoryDC);
+        OnDrawLayer1(memoryDC);
+        memoryDC.RestoreDC(savedDC);
+    }
+
+    // Adds the areas in the client to the merged ones; past maximumDamagedAreaCount they all become one.
+    void Merge(std::vector<CRect>& mergedAreas, const std::vector<CRect>& areas) const
+    {
+        CRect clientRect;
+        view.GetClientRect(&clientRect);
+        for (auto area : areas) {
+            area.NormalizeRect();
+            if (area.IntersectRect(area, clientRect))
+                Merge(mergedAreas, area);
+            if (mergedAreas.size() > maximumDamagedAreaCount) {
+                CRect unitedArea = mergedAreas.front();
+                for (const auto& mergedArea : mergedAreas)
+                    unitedArea.UnionRect(unitedArea, mergedArea);
+                mergedAreas.assign(1, unitedArea);
+            }
+        }
+    }
+
+    // Overlapping or touching areas are merged, so no pixel is redrawn twice.
+    static void Merge(std::vector<CRect>& mergedAreas, CRect area)
+    {
+        for (auto iterator = mergedAreas.begin(); iterator != mergedAreas.end();) {
+            CRect inflatedArea = *iterator;
+            inflatedArea.InflateRect(1, 1);
+            CRect intersection;
+            if (intersection.IntersectRect(inflatedArea, area)) {
+                area.UnionRect(area, *iterator);
+                mergedAreas.erase(iterator);
+                iterator = mergedAreas.begin();
+            } else {
+                ++iterator;
+            }
+        }
+        mergedAreas.push_back(area);
+    }
 };
 
 template <class TView>
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <afx.h>
-#include <random>
 #include "FigureAttribute.h"
+#include "FigurePool.h"
+#include "FigureShape.h"
+#include "GdiObjectCache.h"
 #include "GdiObjectSelector.h"
 #include "Geometry.h"
+#include "area_cache.h"
 
 class Figure : public CObject
 {
@@ -16,6 +19,9 @@ class Figure : public CObject
     FigureAttribute attribute;
     bool            isSelected;
 
+    // bounds cached on first use, dropped when the geometry changes and reinflated when the pen width does
+    mutable shos::area_cache<CRect, int> areaCache;
+
 public:
     const FigureAttribute& Attribute() const
     {
@@ -37,9 +43,45 @@ public:
     {
         attribute  = another.attribute;
         isSelected = another.isSelected;
+        InvalidateArea();
         return *this;
     }
 
+#pragma push_macro("new")
+#undef new
+    static void* operator new(size_t size)
+    {
+#ifdef _DEBUG
+        return ::operator new(size);
+#else // _DEBUG
+        return FigurePool::Get().Allocate(size);
+#endif // _DEBUG
+    }
+
+    static void operator delete(void* pointer, size_t size)
+    {
+#ifdef _DEBUG
+        UNUSED_ALWAYS(size);
+        ::operator delete(pointer);
+#else // _DEBUG
+        FigurePool::Get().Free(pointer, size);
+#endif // _DEBUG
+    }
+
+#ifdef _DEBUG
+    // Debug builds leave the figures to the debug heap, which keeps the allocation sites and reports the leaked ones.
+    static void* operator new(size_t size, LPCSTR fileName, int line)
+    {
+        return ::operator new(size, fileName, line);
+    }
+
+    static void operator delete(void* pointer, LPCSTR fileName, int line)
+    {
+        ::operator delete(pointer, fileName, line);
+    }
+#endif // _DEBUG
+#pragma pop_macro("new")
+
     bool IsSelected() const
     {
         return isSelected;
@@ -55,75 +97,98 @@ public:
         return new Figure(*this);
     }
 
-    void Draw(CDC& dc) const
+    void Draw(CDC& dc, GdiObjectCache& gdiObjectCache) const
     {
         StockObjectSelector stockObjectSelector(dc, NULL_BRUSH);
-        CPen                pen(PS_SOLID, attribute.GetPenWidth(), attribute.GetColor());
-        GdiObjectSelector   penSelector(dc, pen);
+        GdiObjectSelector   penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, attribute.GetPenWidth(), attribute.GetColor()));
 
-        DrawShape(dc);
-        if (isSelected)
-            DrawSelecter(dc);
+        GetShape().Draw(dc);
     }
 
-    void DrawArea(CDC& dc) const
+    // The selector handles are drawn apart from the figures, over the cached drawing, all in one polygon call.
+    static void DrawSelecters(CDC& dc, GdiObjectCache& gdiObjectCache, const std::vector<const Figure*>& figures)
+    {
+        std::vector<POINT> points;
+        std::vector<int>   counts;
+        for (auto figure : figures) {
+            for (const auto& point : figure->GetShape().GetPoints()) {
+                CRect rect(point, point);
+                rect.InflateRect(selectorSize, selectorSize);
+                auto corners = Geometry::ToOutlinePoints(rect);
+                points.insert(points.end(), corners.begin(), corners.end());
+                counts.push_back(static_cast<int>(corners.size()));
+            }
+        }
+        if (counts.empty())
+            return;
+
+        StockObjectSelector stockObjectSelector(dc, NULL_BRUSH);
+        GdiObjectSelector   penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, selectorPenWidth, selectedColor));
+        dc.PolyPolygon(points.data(), counts.data(), static_cast<int>(counts.size()));
+    }
+
+    void DrawArea(CDC& dc, GdiObjectCache& gdiObjectCache) const
     {
         StockObjectSelector stockObjectSelector(dc, NULL_BRUSH);
-        CPen                pen(PS_SOLID, 3, areaColor);
-        GdiObjectSelector   penSelector(dc, pen);
+        GdiObjectSelector   penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, 3, areaColor));
 
         dc.Rectangle(GetArea());
     }
 
     CRect GetArea() const
     {
-        auto area   = GetShapeArea();
-        auto  margin = attribute.GetPenWidth() + selectorSize + selectorPenWidth;
-        area.InflateRect(margin, margin);
-        return area;
+        return areaCache.get(attribute.GetPenWidth(), [this] { return GetShape().GetArea(); }, &Figure::Inflate);
     }
 
-    virtual long GetDistanceFrom(CPoint /* point */) const
+    static CRect GetArea(const FigureShape& shape, const FigureAttribute& attribute)
     {
-        return Geometry::maximumDistance;
+        return Inflate(shape.GetArea(), attribute.GetPenWidth());
     }
-    
-    virtual void Serialize(CArchive& ar) override
+
+    // The concrete shape; hot loops work on it instead of calling through the figure.
+    virtual FigureShape GetShape() const
     {
-        CObject::Serialize(ar);
-        attribute.Serialize(ar);
+        return FigureShape();
     }
 
-protected:
-    virtual void DrawShape(CDC& /* dc */) const
-    {}
-
-    virtual CRect GetShapeArea() const
+    FigureType GetType() const
     {
-        return CRect();
+        return GetShape().GetType();
     }
 
-    virtual std::vector<CPoint> GetPoints() const
+    long GetDistanceFrom(CPoint point) const
     {
-        return std::vector<CPoint>();
+        return GetShape().GetDistanceFrom(point);
     }
     
-private:
-    void DrawSelecter(CDC& dc) const
+    virtual void Serialize(CArchive& ar) override
     {
-        StockObjectSelector stockObjectSelector(dc, NULL_BRUSH);
-        CPen                pen(PS_SOLID, selectorPenWidth, selectedColor);
-        GdiObjectSelector   penSelector(dc, pen);
+        CObject::Serialize(ar);
+        attribute.Serialize(ar);
+        if (!ar.IsStoring())
+            InvalidateArea();
+    }
 
-        auto points = GetPoints();
-        std::for_each(points.begin(), points.end(), [&](const CPoint& point) { DrawSelecter(dc, point); });
+#ifdef _DEBUG
+    virtual void AssertValid() const override
+    {
+        CObject::AssertValid();
+        ASSERT(GetArea() == GetArea(GetShape(), attribute));
     }
+#endif // _DEBUG
 
-    void DrawSelecter(CDC& dc, CPoint point) const
+protected:
+    void InvalidateArea()
     {
-        CRect rect(point, point);
-        rect.InflateRect(selectorSize, selectorSize);
-        dc.Rectangle(rect);
+        areaCache.invalidate();
+    }
+
+private:
+    static CRect Inflate(CRect shapeArea, int penWidth)
+    {
+        auto margin = penWidth + selectorSize + selectorPenWidth;
+        shapeArea.InflateRect(margin, margin);
+        return shapeArea;
     }
 
     DECLARE_SERIAL(Figure)
@@ -131,8 +196,7 @@ private:
 
 class DotFigure : public Figure
 {
-    const long radius = 10L;
-    CPoint     position;
+    CPoint position;
         
 public:
     DotFigure()
@@ -156,10 +220,9 @@ public:
         return new DotFigure(*this);
     }
 
-    virtual long GetDistanceFrom(CPoint point) const override
+    virtual FigureShape GetShape() const override
     {
-        auto distance = Geometry::GetDistance(point, position) - radius;
-        return distance > 0L ? distance : 0L;
+        return DotShape { position };
     }
 
     virtual void Serialize(CArchive& ar) override
@@ -172,23 +235,6 @@ public:
             ar >> position;
     }
 
-protected:
-    virtual void DrawShape(CDC& dc) const override
-    {
-        dc.Ellipse(GetShapeArea());
-    }
-
-    virtual CRect GetShapeArea() const override
-    {
-        const CSize size(radius, radius);
-        return CRect(position - size, position + size);
-    }
-
-    virtual std::vector<CPoint> GetPoints() const
-    {
-        return { position };
-    }
-
     DECLARE_SERIAL(DotFigure)
 };
 
@@ -219,9 +265,9 @@ public:
         return new LineFigure(*this);
     }
 
-    virtual long GetDistanceFrom(CPoint point) const override
+    virtual FigureShape GetShape() const override
     {
-        return Geometry::GetDistanceToLineSegment(point, start, end);
+        return LineShape { start, end };
     }
 
     virtual void Serialize(CArchive& ar) override
@@ -234,25 +280,6 @@ public:
             ar >> start >> end;
     }
 
-protected:
-    virtual void DrawShape(CDC& dc) const override
-    {
-        dc.MoveTo(start);
-        dc.LineTo(end);
-    }
-
-    virtual CRect GetShapeArea() const override
-    {
-        CRect area(start, end);
-        area.NormalizeRect();
-        return area;
-    }
-
-    virtual std::vector<CPoint> GetPoints() const
-    {
-        return { start, end };
-    }
-
     DECLARE_SERIAL(LineFigure)
 };
 
@@ -290,17 +317,6 @@ public:
             ar >> position;
     }
 
-protected:
-    virtual CRect GetShapeArea() const override
-    {
-        return position;
-    }
-
-    virtual std::vector<CPoint> GetPoints() const
-    {
-        return Geometry::ToPoints(position);
-    }
-
     DECLARE_SERIAL(RectangleFigureBase)
 };
 
@@ -324,15 +340,9 @@ public:
         return new RectangleFigure(*this);
     }
 
-protected:
-    virtual void DrawShape(CDC& dc) const override
-    {
-        dc.Rectangle(&position);
-    }
-
-    virtual long GetDistanceFrom(CPoint point) const override
+    virtual FigureShape GetShape() const override
     {
-        return Geometry::GetDistance(point, position);
+        return RectangleShape { position };
     }
 
     DECLARE_SERIAL(RectangleFigure)
@@ -358,86 +368,10 @@ public:
         return new EllipseFigure(*this);
     }
 
-protected:
-    virtual void DrawShape(CDC& dc) const override
-    {
-        dc.Ellipse(&position);
-    }
-
-    virtual long GetDistanceFrom(CPoint point) const override
+    virtual FigureShape GetShape() const override
     {
-        return Geometry::GetDistanceToEllipse(point, position);
+        return EllipseShape { position };
     }
 
     DECLARE_SERIAL(EllipseFigure)
 };
-
-class FigureHelper
-{
-    static const long         figureKindNumber = 4;
-
-    static std::random_device random;
-    static std::mt19937       mt;
-
-public:
-    static std::vector<Figure*> GetRandomFigures(size_t count, const CRect& area)
-    {
-        std::vector<Figure*> figures;
-        for (size_t counter = 0; counter < count; counter++)
-            figures.push_back(GetRandomFigure(area));
-        return figures;
-    }
-
-    static bool GetArea(std::vector<Figure*> figures, CRect& area)
-    {
-        if (figures.size() == 0)
-            return false;
-
-        std::vector<CRect> areas(figures.size());
-        std::transform(figures.begin(), figures.end(), areas.begin(), [](Figure* figure) { return figure->GetArea(); });
-        return Geometry::GetArea(areas, area);
-    }
-
-private:
-    static Figure* GetRandomFigure(const CRect& area)
-    {
-        Figure* figure = nullptr;
-        
-        switch (RandomValue(0, figureKindNumber - 1)) {
-        case 0:
-            figure = new DotFigure(RandomPosition(area));
-            break;
-        case 1:
-            figure = new LineFigure(RandomPosition(area), RandomPosition(area));
-            break;
-        case 2:
-            figure = new RectangleFigure(CRect(RandomPosition(area), RandomPosition(area)));
-            break;
-        case 3:
-            figure = new EllipseFigure(CRect(RandomPosition(area), RandomPosition(area)));
-            break;
-        default:
-            ASSERT(false);
-            figure = nullptr;
-            break;
-        }
-        figure->Attribute().SetColor   (RandomColor()                         );
-        figure->Attribute().SetPenWidth(RandomValue(0, 5));
-        return figure;
-    }
-
-    static CPoint RandomPosition(const CRect& area)
-    {
-        return CPoint(RandomValue(area.left, area.right), RandomValue(area.top, area.bottom));
-    }
-
-    static LONG RandomValue(long minimum, long maxmum)
-    {
-        return minimum + mt() % (maxmum - minimum + 1);
-    };
-
-    static COLORREF RandomColor()
-    {
-        return RGB(RandomValue(0, 255), RandomValue(0, 255), RandomValue(0, 255));
-    }
-};
@@ -69,6 +69,10 @@ public:
     FigureAttribute() : color(RGB(0x00, 0x00, 0x00)), isColorValid(true), penWidth(0), isPenWidthValid(true)
     {}
 
+    FigureAttribute(COLORREF color, bool isColorValid, int penWidth, bool isPenWidthValid)
+        : color(color), isColorValid(isColorValid), penWidth(penWidth), isPenWidthValid(isPenWidthValid)
+    {}
+
     void Serialize(CArchive& ar)
     {
         if (ar.IsStoring())
@@ -28,17 +28,16 @@ void FigureAttributeDialog::DoDataExchange(CDataExchange* pDX)
         Load(pDX);
 }
 
-void FigureAttributeDialog::SavePenWidth(CDataExchange* pDX)
+bool FigureAttributeDialog::SavePenWidth(CDataExchange* pDX)
 {
     CString penWidthText;
     GetDlgItemText(IDC_PEN_WIDTH_EDIT, penWidthText);
     if (penWidthText.IsEmpty())
-        return;
+        return false;
 
     int penWidth;
     DDX_Text(pDX, IDC_PEN_WIDTH_EDIT, penWidth);
-    if (figureAttribute.SetPenWidth(penWidth))
-        NotifyObservers(figureAttribute);
+    return figureAttribute.SetPenWidth(penWidth);
 }
 
 void FigureAttributeDialog::LoadPenWidth(CDataExchange* pDX)
@@ -33,19 +33,22 @@ protected:
     DECLARE_MESSAGE_MAP()
 
 private:
+    // Notifies once for all that one exchange changes, so that they are undone as one step.
+    // The pen width goes first: if it fails validation, the color is left to the next exchange.
     void Save(CDataExchange* pDX)
     {
-        SaveColor();
-        SavePenWidth(pDX);
+        auto isPenWidthChanged = SavePenWidth(pDX);
+        auto isColorChanged    = SaveColor();
+        if (isPenWidthChanged || isColorChanged)
+            NotifyObservers(figureAttribute);
     }
 
-    void SaveColor()
+    bool SaveColor()
     {
-        if (figureAttribute.SetColor(colorButton.GetColor()))
-            NotifyObservers(figureAttribute);
+        return figureAttribute.SetColor(colorButton.GetColor());
     }
 
-    void SavePenWidth(CDataExchange* pDX);
+    bool SavePenWidth(CDataExchange* pDX);
 
     void Load(CDataExchange* pDX)
     {
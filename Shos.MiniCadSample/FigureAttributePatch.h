@@ -0,0 +1,75 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include "Figure.h"
+#include "undo_redo_vector.h"
+
+// Sets an attribute to figures in place as an undo step, instead of replacing them with changed clones.
+// It holds one attribute per figure, exchanged with the figure's own on each application;
+// the attributes are kept run-length encoded, as the figures changed at once mostly share theirs.
+class FigureAttributePatch : public shos::element_patch<Figure*>
+{
+    struct Run
+    {
+        FigureAttribute attribute;
+        size_t          count;
+    };
+
+    std::vector<Run> runs;
+    std::vector<Run> nextRuns;
+    size_t           runIndex;
+    size_t           runOffset;
+
+public:
+    FigureAttributePatch(const FigureAttribute& attribute, size_t count) : runs(1, Run { attribute, count }), runIndex(0), runOffset(0)
+    {}
+
+    virtual void exchange(size_t offset, Figure*& figure) override
+    {
+        if (offset == 0) {
+            nextRuns.clear();
+            runIndex  = 0;
+            runOffset = 0;
+        }
+
+        auto attribute = runs[runIndex].attribute;
+        if (++runOffset == runs[runIndex].count) {
+            runIndex++;
+            runOffset = 0;
+        }
+        Append(figure->Attribute());
+        figure->Attribute() = attribute;
+
+        if (runIndex == runs.size()) {
+            runs.swap(nextRuns);
+            std::vector<Run>().swap(nextRuns);
+        }
+    }
+
+    virtual size_t footprint() const override
+    {
+        return sizeof(*this) + (runs.capacity() + nextRuns.capacity()) * sizeof(Run);
+    }
+
+    // Each patch holds the whole attribute, so the older one restores all a newer one set.
+    virtual bool covers(const shos::element_patch<Figure*>& newer) const override
+    {
+        return dynamic_cast<const FigureAttributePatch*>(&newer) != nullptr;
+    }
+
+private:
+    void Append(const FigureAttribute& attribute)
+    {
+        if (!nextRuns.empty() && IsEqual(nextRuns.back().attribute, attribute))
+            nextRuns.back().count++;
+        else
+            nextRuns.push_back(Run { attribute, 1 });
+    }
+
+    static bool IsEqual(const FigureAttribute& attribute1, const FigureAttribute& attribute2)
+    {
+        return attribute1.GetColor    () == attribute2.GetColor    () && attribute1.IsColorValid   () == attribute2.IsColorValid   () &&
+               attribute1.GetPenWidth () == attribute2.GetPenWidth () && attribute1.IsPenWidthValid() == attribute2.IsPenWidthValid();
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include "Figure.h"
+#include "GdiObjectCache.h"
+
+// Draws figures given in z-order grouped by pen, so a dense drawing takes a few GDI calls instead of a few per figure.
+// Lines and rectangle outlines of a group go out in one PolyPolyline; dots and ellipses still take a call each, but share the pen.
+// A figure joins the latest group of its pen only when it overlaps none of the groups opened after it, so overlapping figures keep their order.
+class FigureBatch
+{
+    static const size_t maximumGroupCount = 32;
+    static const size_t maximumPointCount = 64 * 1024;
+
+    struct Group
+    {
+        COLORREF           color;
+        int                penWidth;
+        CRect              bounds;
+        std::vector<POINT> points;
+        std::vector<DWORD> counts;
+        std::vector<RECT>  ellipses;
+    };
+
+    // Sends the concrete shapes into a group.
+    class Collector
+    {
+        Group& group;
+
+    public:
+        Collector(Group& group) : group(group)
+        {}
+
+        void operator ()(const NoShape& /* shape */) const
+        {}
+
+        void operator ()(const DotShape& shape) const
+        {
+            group.ellipses.push_back(shape.GetArea());
+        }
+
+        void operator ()(const LineShape& shape) const
+        {
+            group.points.push_back(shape.start);
+            group.points.push_back(shape.end  );
+            group.counts.push_back(2);
+        }
+
+        void operator ()(const RectangleShape& shape) const
+        {
+            auto corners = Geometry::ToOutlinePoints(shape.position);
+            group.points.insert(group.points.end(), corners.begin(), corners.end());
+            group.points.push_back(corners.front());
+            group.counts.push_back(static_cast<DWORD>(corners.size() + 1));
+        }
+
+        void operator ()(const EllipseShape& shape) const
+        {
+            group.ellipses.push_back(shape.position);
+        }
+    };
+
+    CDC&               dc;
+    GdiObjectCache&    gdiObjectCache;
+    std::vector<Group> groups;
+    size_t             pointCount;
+
+public:
+    FigureBatch(CDC& dc, GdiObjectCache& gdiObjectCache) : dc(dc), gdiObjectCache(gdiObjectCache), pointCount(0)
+    {
+        groups.reserve(maximumGroupCount);
+    }
+
+    FigureBatch(const FigureBatch&) = delete;
+    FigureBatch& operator =(const FigureBatch&) = delete;
+
+    void Add(const Figure& figure)
+    {
+        auto& group    = GetGroup(figure);
+        auto  shape    = figure.GetShape();
+        auto  oldCount = group.points.size() + group.ellipses.size();
+        shape.Visit(Collector(group));
+        group.bounds.UnionRect(group.bounds, figure.GetArea());
+
+        pointCount += group.points.size() + group.ellipses.size() - oldCount;
+        if (pointCount > maximumPointCount)
+            Flush();
+    }
+
+    // Draws the groups in the order they were opened.
+    void Flush()
+    {
+        if (groups.empty())
+            return;
+
+        StockObjectSelector stockObjectSelector(dc, NULL_BRUSH);
+        for (const auto& group : groups) {
+            GdiObjectSelector penSelector(dc, gdiObjectCache.GetPen(PS_SOLID, group.penWidth, group.color));
+            if (!group.counts.empty())
+                dc.PolyPolyline(group.points.data(), group.counts.data(), static_cast<int>(group.counts.size()));
+            for (const auto& ellipse : group.ellipses)
+                dc.Ellipse(&ellipse);
+        }
+        groups.clear();
+        pointCount = 0;
+    }
+
+private:
+    Group& GetGroup(const Figure& figure)
+    {
+        auto color    = figure.Attribute().GetColor   ();
+        auto penWidth = figure.Attribute().GetPenWidth();
+        auto area     = figure.GetArea();
+
+        for (auto iterator = groups.rbegin(); iterator != groups.rend(); ++iterator) {
+            if (iterator->color == color && iterator->penWidth == penWidth)
+                return *iterator;
+            CRect intersection;
+            if (intersection.IntersectRect(iterator->bounds, area))
+                break;
+        }
+
+        if (groups.size() == maximumGroupCount)
+            Flush();
+        groups.push_back(Group { color, penWidth, CRect() });
+        return groups.back();
+    }
+};
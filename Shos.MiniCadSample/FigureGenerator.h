@@ -0,0 +1,237 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include <thread>
+#include <exception>
+#include "Figure.h"
+
+// Builds random figures for stress documents.
+// Every figure is drawn from its own counter-based random stream keyed by the seed and its index,
+// so the figures for a seed are the same however the work is split between threads.
+// Each value is drawn into a local of its own, as the order the arguments of a call are evaluated in is up to the compiler.
+class FigureGenerator
+{
+public:
+    enum class Distribution
+    {
+        Uniform        ,
+        Clustered      ,
+        LongLineHeavy  ,
+        TinyFigureHeavy
+    };
+
+private:
+    static const long   figureKindNumber      = 4;
+    static const long   clusterNumber         = 16;
+    static const long   maximumTinySize       = 4;
+    static const long   maximumPenWidth       = 5;
+    static const size_t minimumCountPerThread = 10000;
+
+    // SplitMix64
+    class Random
+    {
+        ULONGLONG state;
+
+    public:
+        Random(ULONGLONG seed, ULONGLONG stream) : state(Mix(seed ^ Mix(stream)))
+        {}
+
+        ULONGLONG Next()
+        {
+            state += 0x9e3779b97f4a7c15ULL;
+            return Mix(state);
+        }
+
+        long Between(long minimum, long maximum)
+        {
+            return minimum + static_cast<long>(Next() % static_cast<ULONGLONG>(maximum - minimum + 1));
+        }
+
+        bool Chance(long percentage)
+        {
+            return Between(0, 99) < percentage;
+        }
+
+    private:
+        static ULONGLONG Mix(ULONGLONG value)
+        {
+            value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+            return value ^ (value >> 31);
+        }
+    };
+
+    const CRect         area;
+    const ULONGLONG     seed;
+    const Distribution  distribution;
+    std::vector<CPoint> clusterCenters;
+
+public:
+    FigureGenerator(const CRect& area, ULONGLONG seed, Distribution distribution = Distribution::Uniform)
+        : area(area), seed(seed), distribution(distribution)
+    {
+        if (distribution == Distribution::Clustered) {
+            // the cluster streams count down from the top so that they never meet the figure streams
+            for (long cluster = 0; cluster < clusterNumber; cluster++) {
+                Random random(seed, ~static_cast<ULONGLONG>(cluster));
+                clusterCenters.push_back(RandomPosition(random));
+            }
+        }
+    }
+
+    Figure* Generate(size_t index) const
+    {
+        Random random(seed, index);
+        auto   kind = random.Between(0, figureKindNumber - 1);
+
+        CPoint point1, point2;
+        switch (distribution) {
+        case Distribution::Clustered:
+            {
+                const auto& center = clusterCenters[random.Between(0, clusterNumber - 1)];
+                point1 = ClusteredPosition(random, center);
+                point2 = ClusteredPosition(random, center);
+            }
+            break;
+        case Distribution::LongLineHeavy:
+            if (random.Chance(75)) {
+                kind = 1;
+                GetLongLine(random, point1, point2);
+            } else {
+                point1 = RandomPosition(random);
+                point2 = RandomPosition(random);
+            }
+            break;
+        case Distribution::TinyFigureHeavy:
+            point1 = RandomPosition(random);
+            if (random.Chance(80)) {
+                auto width  = random.Between(-maximumTinySize, maximumTinySize);
+                auto height = random.Between(-maximumTinySize, maximumTinySize);
+                point2 = Clamp(point1 + CSize(width, height));
+            } else {
+                point2 = RandomPosition(random);
+            }
+            break;
+        default:
+            point1 = RandomPosition(random);
+            point2 = RandomPosition(random);
+            break;
+        }
+
+        auto red      = random.Between(0, 255);
+        auto green    = random.Between(0, 255);
+        auto blue     = random.Between(0, 255);
+        auto penWidth = random.Between(0, maximumPenWidth);
+        auto figure   = Create(kind, point1, point2);
+        figure->Attribute().SetColor   (RGB(red, green, blue));
+        figure->Attribute().SetPenWidth(penWidth);
+        return figure;
+    }
+
+    // Generates the figures with the indices firstIndex to firstIndex + count - 1, in that order.
+    // threadCount 0 uses one thread per core for large counts.
+    std::vector<Figure*> Generate(size_t firstIndex, size_t count, size_t threadCount = 0) const
+    {
+        if (threadCount == 0)
+            threadCount = (std::max)(size_t(1), (std::min)(size_t(std::thread::hardware_concurrency()), count / minimumCountPerThread));
+
+        std::vector<Figure*> figures(count, nullptr);
+        if (threadCount <= 1) {
+            Generate(figures, firstIndex, 0, count);
+            return figures;
+        }
+
+        std::vector<std::thread>        threads;
+        std::vector<std::exception_ptr> errors(threadCount);
+        for (size_t thread = 0; thread < threadCount; thread++) {
+            auto begin = count *  thread      / threadCount;
+            auto end   = count * (thread + 1) / threadCount;
+            threads.push_back(std::thread([&, thread, begin, end] {
+                try {
+                    Generate(figures, firstIndex, begin, end);
+                } catch (...) {
+                    errors[thread] = std::current_exception();
+                }
+            }));
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        for (auto& error : errors) {
+            if (error != nullptr) {
+                for (auto figure : figures)
+                    delete figure;
+                std::rethrow_exception(error);
+            }
+        }
+        return figures;
+    }
+
+private:
+    void Generate(std::vector<Figure*>& figures, size_t firstIndex, size_t begin, size_t end) const
+    {
+        for (auto index = begin; index < end; index++)
+            figures[index] = Generate(firstIndex + index);
+    }
+
+    static Figure* Create(long kind, CPoint point1, CPoint point2)
+    {
+        switch (kind) {
+        case 0:
+            return new DotFigure(point1);
+        case 1:
+            return new LineFigure(point1, point2);
+        case 2:
+            return new RectangleFigure(CRect(point1, point2));
+        default:
+            return new EllipseFigure(CRect(point1, point2));
+        }
+    }
+
+    CPoint RandomPosition(Random& random) const
+    {
+        return RandomPosition(random, area.left, area.right, area.top, area.bottom);
+    }
+
+    static CPoint RandomPosition(Random& random, long left, long right, long top, long bottom)
+    {
+        auto x = random.Between(left, right);
+        auto y = random.Between(top, bottom);
+        return CPoint(x, y);
+    }
+
+    CPoint ClusteredPosition(Random& random, CPoint center) const
+    {
+        auto spread = (std::min)(area.Width(), area.Height()) / 32;
+        auto width  = ClusteredOffset(random, spread);
+        auto height = ClusteredOffset(random, spread);
+        return Clamp(center + CSize(width, height));
+    }
+
+    // the sum of two uniform offsets leans towards the center
+    static long ClusteredOffset(Random& random, long spread)
+    {
+        auto offset1 = random.Between(-spread, spread);
+        auto offset2 = random.Between(-spread, spread);
+        return offset1 + offset2;
+    }
+
+    void GetLongLine(Random& random, CPoint& start, CPoint& end) const
+    {
+        auto quarterWidth  = area.Width () / 4;
+        auto quarterHeight = area.Height() / 4;
+        if (random.Chance(50)) {
+            start = RandomPosition(random, area.left                , area.left + quarterWidth, area.top, area.bottom);
+            end   = RandomPosition(random, area.right - quarterWidth, area.right              , area.top, area.bottom);
+        } else {
+            start = RandomPosition(random, area.left, area.right, area.top                   , area.top + quarterHeight);
+            end   = RandomPosition(random, area.left, area.right, area.bottom - quarterHeight, area.bottom);
+        }
+    }
+
+    CPoint Clamp(CPoint point) const
+    {
+        return CPoint((std::min)((std::max)(point.x, area.left), area.right), (std::min)((std::max)(point.y, area.top), area.bottom));
+    }
+};
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include "Figure.h"
+#include "undo_redo_vector.h"
+
+// Keeps the figures retained by cold undo steps in a memory-mapped temporary file.
+// The figures are serialized, copied into the file and deleted on a background thread without holding up undo, which reads them back when it reaches their step.
+// When the file cannot be used, the figures simply stay in memory; when a block cannot be read back, restore throws std::runtime_error.
+class FigureHistorySpiller : public shos::history_spiller<Figure*>
+{
+    static const ULONGLONG initialFileSize = 16 * 1024 * 1024;
+
+    // A growable read-write view of a temporary file that is deleted when closed.
+    class SpillFile
+    {
+        HANDLE    file;
+        HANDLE    mapping;
+        BYTE*     view;
+        ULONGLONG capacity;
+
+    public:
+        SpillFile() : file(INVALID_HANDLE_VALUE), mapping(nullptr), view(nullptr), capacity(0)
+        {}
+
+        SpillFile(const SpillFile&) = delete;
+        SpillFile& operator =(const SpillFile&) = delete;
+
+        virtual ~SpillFile()
+        {
+            Unmap();
+            if (file != INVALID_HANDLE_VALUE)
+                ::CloseHandle(file);
+        }
+
+        BYTE* GetView() const
+        {
+            return view;
+        }
+
+        bool Reserve(ULONGLONG size)
+        {
+            if (size <= capacity)
+                return true;
+            if (file == INVALID_HANDLE_VALUE && !Open())
+                return false;
+
+            auto newCapacity = (std::max)(capacity, initialFileSize);
+            while (newCapacity < size)
+                newCapacity *= 2;
+
+            Unmap();
+            mapping = ::CreateFileMapping(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(newCapacity >> 32), static_cast<DWORD>(newCapacity), nullptr);
+            if (mapping != nullptr)
+                view = static_cast<BYTE*>(::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+            if (view == nullptr) {
+                Unmap();
+                capacity = 0;
+                return false;
+            }
+            capacity = newCapacity;
+            return true;
+        }
+
+    private:
+        bool Open()
+        {
+            TCHAR folder[MAX_PATH];
+            TCHAR path  [MAX_PATH];
+            if (::GetTempPath(MAX_PATH, folder) == 0 || ::GetTempFileName(folder, _T("mcs"), 0, path) == 0)
+                return false;
+
+            file = ::CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+            return file != INVALID_HANDLE_VALUE;
+        }
+
+        void Unmap()
+        {
+            if (view != nullptr) {
+                ::UnmapViewOfFile(view);
+                view = nullptr;
+            }
+            if (mapping != nullptr) {
+                ::CloseHandle(mapping);
+                mapping = nullptr;
+            }
+        }
+    };
+
+    struct Block
+    {
+        ULONGLONG offset;
+        ULONGLONG size;
+    };
+
+    using Item = std::pair<size_t, std::vector<Figure*>>;
+
+    std::unique_ptr<SpillFile>                       spillFile;
+    std::unordered_map<size_t, Block>                blocks;
+    std::unordered_map<size_t, std::vector<Figure*>> residentFigures;
+    std::deque<Item>                                 queue;
+    size_t                                           writingKey;
+    bool                                             isWriting;
+    size_t                                           nextKey;
+    ULONGLONG                                        usedSize;
+    ULONGLONG                                        liveSize;
+
+    std::mutex                                       mutex;
+    std::condition_variable                          condition;
+    std::thread                                      worker;
+    bool                                             isStopping;
+
+public:
+    FigureHistorySpiller() : spillFile(new SpillFile), writingKey(0), isWriting(false), nextKey(0), usedSize(0), liveSize(0), isStopping(false)
+    {}
+
+    FigureHistorySpiller(const FigureHistorySpiller&) = delete;
+    FigureHistorySpiller& operator =(const FigureHistorySpiller&) = delete;
+
+    virtual ~FigureHistorySpiller()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isStopping = true;
+        }
+        condition.notify_all();
+        if (worker.joinable())
+            worker.join();
+
+        for (auto& item : queue)
+            Delete(item.second);
+        for (auto& item : residentFigures)
+            Delete(item.second);
+    }
+
+    virtual size_t spill(std::vector<Figure*> figures) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!worker.joinable())
+            worker = std::thread([this] { Run(); });
+
+        auto key = nextKey++;
+        queue.push_back(Item(key, std::move(figures)));
+        condition.notify_all();
+        return key;
+    }
+
+    virtual std::vector<Figure*> restore(size_t key) override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::vector<Figure*> figures;
+        if (Take(key, figures))
+            return figures;
+
+        condition.wait(lock, [&] { return !isWriting || writingKey != key; });
+        if (Take(key, figures))
+            return figures;
+
+        auto iterator = blocks.find(key);
+        ASSERT(iterator != blocks.end());
+        figures = Read(iterator->second);
+        Release(iterator);
+        return figures;
+    }
+
+    virtual void discard(size_t key) override
+    {
+        std::vector<Figure*> figures;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!Take(key, figures)) {
+                condition.wait(lock, [&] { return !isWriting || writingKey != key; });
+                if (!Take(key, figures)) {
+                    auto iterator = blocks.find(key);
+                    ASSERT(iterator != blocks.end());
+                    Release(iterator);
+                }
+            }
+        }
+        Delete(figures);
+    }
+
+private:
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            condition.wait(lock, [&] { return isStopping || !queue.empty(); });
+            if (isStopping)
+                return;
+
+            auto item = std::move(queue.front());
+            queue.pop_front();
+            writingKey = item.first;
+            isWriting  = true;
+
+            lock.unlock();
+            CMemFile memoryFile;
+            auto     isSerialized = Serialize(item.second, memoryFile);
+            lock.lock();
+
+            if (isSerialized && Write(item.first, memoryFile, lock)) {
+                lock.unlock();
+                Delete(item.second);
+                lock.lock();
+            } else {
+                residentFigures[item.first] = std::move(item.second);
+            }
+            isWriting = false;
+            condition.notify_all();
+        }
+    }
+
+    // Takes the figures of the key back when they have not been written out.
+    bool Take(size_t key, std::vector<Figure*>& figures)
+    {
+        auto resident = residentFigures.find(key);
+        if (resident != residentFigures.end()) {
+            figures = std::move(resident->second);
+            residentFigures.erase(resident);
+            return true;
+        }
+
+        auto queued = std::find_if(queue.begin(), queue.end(), [&](const Item& item) { return item.first == key; });
+        if (queued != queue.end()) {
+            figures = std::move(queued->second);
+            queue.erase(queued);
+            return true;
+        }
+        return false;
+    }
+
+    static bool Serialize(const std::vector<Figure*>& figures, CMemFile& memoryFile)
+    {
+        try {
+            CArchive ar(&memoryFile, CArchive::store);
+            ar.WriteCount(figures.size());
+            for (auto figure : figures) {
+                ar << static_cast<BYTE>(figure->IsSelected() ? 1 : 0);
+                ar.WriteObject(figure);
+            }
+            ar.Close();
+            return true;
+        } catch (CException* exception) {
+            exception->Delete();
+            return false;
+        }
+    }
+
+    // Claims the room for the block under the lock and copies into it without the lock.
+    // Only this thread maps the file, and restore and discard of the key wait while it is being written, so the room stays put.
+    bool Write(size_t key, CMemFile& memoryFile, std::unique_lock<std::mutex>& lock)
+    {
+        auto size = memoryFile.GetLength();
+        if (usedSize > 2 * liveSize + initialFileSize)
+            Compact(lock);
+        if (!spillFile->Reserve(usedSize + size))
+            return false;
+
+        auto destination = spillFile->GetView() + usedSize;
+        blocks[key] = Block { usedSize, size };
+        usedSize += size;
+        liveSize += size;
+
+        lock.unlock();
+        auto buffer = memoryFile.Detach();
+        std::memcpy(destination, buffer, static_cast<size_t>(size));
+        std::free(buffer);
+        lock.lock();
+        return true;
+    }
+
+    std::vector<Figure*> Read(const Block& block)
+    {
+        std::vector<Figure*> figures;
+        try {
+            CMemFile memoryFile(spillFile->GetView() + block.offset, static_cast<UINT>(block.size));
+            CArchive ar(&memoryFile, CArchive::load);
+            auto count = ar.ReadCount();
+            figures.reserve(count);
+            for (DWORD_PTR counter = 0L; counter < count; counter++) {
+                BYTE selected = 0;
+                ar >> selected;
+                auto object = ar.ReadObject(RUNTIME_CLASS(Figure));
+                if (object == nullptr)
+                    AfxThrowArchiveException(CArchiveException::badClass);
+                auto figure = static_cast<Figure*>(object);
+                figure->Select(selected != 0);
+                figures.push_back(figure);
+            }
+        } catch (CException* exception) {
+            // a truncated or corrupt block throws CArchiveException or CFileException
+            exception->Delete();
+            Delete(figures);
+            throw std::runtime_error("The undo history kept in the temporary file cannot be read back.");
+        }
+        return figures;
+    }
+
+    void Release(std::unordered_map<size_t, Block>::iterator iterator)
+    {
+        // undo restores the newest blocks first, so the end of the file usually shrinks back
+        if (iterator->second.offset + iterator->second.size == usedSize)
+            usedSize = iterator->second.offset;
+        liveSize -= iterator->second.size;
+        blocks.erase(iterator);
+        if (blocks.empty())
+            usedSize = 0;
+    }
+
+    // Copies the live blocks into a new file without the gaps left by discarded ones, and swaps the files.
+    // The copying goes without the lock, so undo can read from the old file meanwhile; blocks released meanwhile only leave gaps.
+    void Compact(std::unique_lock<std::mutex>& lock)
+    {
+        using KeyedBlock = std::pair<size_t, Block>;
+
+        std::vector<KeyedBlock> liveBlocks(blocks.begin(), blocks.end());
+        std::sort(liveBlocks.begin(), liveBlocks.end(), [](const KeyedBlock& block1, const KeyedBlock& block2) { return block1.second.offset < block2.second.offset; });
+
+        lock.unlock();
+        std::unique_ptr<SpillFile> compactFile(new SpillFile);
+        ULONGLONG                  compactSize = 0;
+        for (const auto& liveBlock : liveBlocks)
+            compactSize += liveBlock.second.size;
+        auto isReserved = compactFile->Reserve(compactSize);
+        if (isReserved) {
+            ULONGLONG offset = 0;
+            for (auto& liveBlock : liveBlocks) {
+                std::memcpy(compactFile->GetView() + offset, spillFile->GetView() + liveBlock.second.offset, static_cast<size_t>(liveBlock.second.size));
+                liveBlock.second.offset  = offset;
+                offset                  += liveBlock.second.size;
+            }
+        }
+        lock.lock();
+        if (!isReserved)
+            return;
+
+        for (const auto& liveBlock : liveBlocks) {
+            auto iterator = blocks.find(liveBlock.first);
+            if (iterator != blocks.end())
+                iterator->second.offset = liveBlock.second.offset;
+        }
+        spillFile.swap(compactFile);
+        usedSize = blocks.empty() ? 0 : compactSize;
+
+        // the old file goes without the lock, as unmapping it takes a while
+        lock.unlock();
+        compactFile.reset();
+        lock.lock();
+    }
+
+    static void Delete(std::vector<Figure*>& figures)
+    {
+        for (auto figure : figures)
+            delete figure;
+        figures.clear();
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "size_class_pool.h"
+
+// The pool the figures are allocated from in release builds.
+class FigurePool : public shos::size_class_pool<>
+{
+public:
+    static FigurePool& Get()
+    {
+        static FigurePool pool;
+        return pool;
+    }
+
+    void* Allocate(size_t size)
+    {
+        return allocate(size);
+    }
+
+    void Free(void* pointer, size_t size)
+    {
+        deallocate(pointer, size);
+    }
+
+    void Trim()
+    {
+        trim();
+    }
+
+    // Counts the blocks other threads keep for reuse as live.
+    size_t GetLiveCount()
+    {
+        return live_count();
+    }
+
+private:
+    FigurePool()
+    {}
+};
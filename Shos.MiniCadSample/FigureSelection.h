@@ -0,0 +1,76 @@
+#pragma once
+
+#include <afx.h>
+#include <unordered_set>
+#include <unordered_map>
+#include "Figure.h"
+
+class FigureSelection
+{
+    std::unordered_set<Figure*>          figures;
+    std::unordered_map<COLORREF, size_t> colorCounts;
+    std::unordered_map<int, size_t>      penWidthCounts;
+
+public:
+    size_t Size() const
+    {
+        return figures.size();
+    }
+
+    bool IsEmpty() const
+    {
+        return figures.empty();
+    }
+
+    bool Contains(Figure* figure) const
+    {
+        return figures.find(figure) != figures.end();
+    }
+
+    // The figures in no particular order.
+    std::vector<Figure*> GetFigures() const
+    {
+        return std::vector<Figure*>(figures.begin(), figures.end());
+    }
+
+    void Add(Figure* figure)
+    {
+        if (figures.insert(figure).second) {
+            colorCounts   [figure->Attribute().GetColor   ()]++;
+            penWidthCounts[figure->Attribute().GetPenWidth()]++;
+        }
+    }
+
+    void Remove(Figure* figure)
+    {
+        if (figures.erase(figure) != 0) {
+            Decrement(colorCounts   , figure->Attribute().GetColor   ());
+            Decrement(penWidthCounts, figure->Attribute().GetPenWidth());
+        }
+    }
+
+    void Clear()
+    {
+        figures       .clear();
+        colorCounts   .clear();
+        penWidthCounts.clear();
+    }
+
+    // Same result as FigureAttribute::GetSum over the attributes of the selected figures in z-order,
+    // given the first of them: the values are its own, valid where all the selected figures share them.
+    FigureAttribute GetAttribute(const Figure& firstFigure) const
+    {
+        return FigureAttribute(firstFigure.Attribute().GetColor   (), colorCounts   .size() == 1,
+                               firstFigure.Attribute().GetPenWidth(), penWidthCounts.size() == 1);
+    }
+
+private:
+    template <typename TKey>
+    static void Decrement(std::unordered_map<TKey, size_t>& counts, TKey key)
+    {
+        auto iterator = counts.find(key);
+        ASSERT(iterator != counts.end());
+        if (--iterator->second == 0)
+            counts.erase(iterator);
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include "Geometry.h"
+
+enum class FigureType : BYTE
+{
+    None     ,
+    Dot      ,
+    Line     ,
+    Rectangle,
+    Ellipse
+};
+
+struct NoShape
+{
+    CRect GetArea() const
+    {
+        return CRect();
+    }
+
+    long GetDistanceFrom(CPoint /* point */) const
+    {
+        return Geometry::maximumDistance;
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return std::vector<CPoint>();
+    }
+
+    void Draw(CDC& /* dc */) const
+    {}
+};
+
+struct DotShape
+{
+    static const long radius = 10L;
+
+    POINT position;
+
+    CRect GetArea() const
+    {
+        const CSize size(radius, radius);
+        return CRect(CPoint(position) - size, CPoint(position) + size);
+    }
+
+    long GetDistanceFrom(CPoint point) const
+    {
+        auto distance = Geometry::GetDistance(point, position) - radius;
+        return distance > 0L ? distance : 0L;
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return { position };
+    }
+
+    void Draw(CDC& dc) const
+    {
+        dc.Ellipse(GetArea());
+    }
+};
+
+struct LineShape
+{
+    POINT start;
+    POINT end;
+
+    CRect GetArea() const
+    {
+        CRect area(start, end);
+        area.NormalizeRect();
+        return area;
+    }
+
+    long GetDistanceFrom(CPoint point) const
+    {
+        return Geometry::GetDistanceToLineSegment(point, start, end);
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return { start, end };
+    }
+
+    void Draw(CDC& dc) const
+    {
+        dc.MoveTo(start);
+        dc.LineTo(end);
+    }
+};
+
+struct RectangleShape
+{
+    RECT position;
+
+    CRect GetArea() const
+    {
+        return position;
+    }
+
+    long GetDistanceFrom(CPoint point) const
+    {
+        return Geometry::GetDistance(point, CRect(position));
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return Geometry::ToPoints(position);
+    }
+
+    void Draw(CDC& dc) const
+    {
+        dc.Rectangle(&position);
+    }
+};
+
+struct EllipseShape
+{
+    RECT position;
+
+    CRect GetArea() const
+    {
+        return position;
+    }
+
+    long GetDistanceFrom(CPoint point) const
+    {
+        return Geometry::GetDistanceToEllipse(point, position);
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return Geometry::ToPoints(position);
+    }
+
+    void Draw(CDC& dc) const
+    {
+        dc.Ellipse(&position);
+    }
+};
+
+// Closed representation of the concrete figure shapes.
+// Visit switches over the type tag and calls the visitor with the concrete shape, so the call is resolved at compile time.
+class FigureShape
+{
+    FigureType type;
+    union
+    {
+        DotShape       dot;
+        LineShape      line;
+        RectangleShape rectangle;
+        EllipseShape   ellipse;
+    };
+
+public:
+    FigureShape() : type(FigureType::None), rectangle()
+    {}
+
+    FigureShape(const DotShape& dot) : type(FigureType::Dot), dot(dot)
+    {}
+
+    FigureShape(const LineShape& line) : type(FigureType::Line), line(line)
+    {}
+
+    FigureShape(const RectangleShape& rectangle) : type(FigureType::Rectangle), rectangle(rectangle)
+    {}
+
+    FigureShape(const EllipseShape& ellipse) : type(FigureType::Ellipse), ellipse(ellipse)
+    {}
+
+    FigureType GetType() const
+    {
+        return type;
+    }
+
+    template <typename TVisitor>
+    auto Visit(TVisitor visitor) const -> decltype(visitor(NoShape()))
+    {
+        switch (type) {
+        case FigureType::Dot:
+            return visitor(dot);
+        case FigureType::Line:
+            return visitor(line);
+        case FigureType::Rectangle:
+            return visitor(rectangle);
+        case FigureType::Ellipse:
+            return visitor(ellipse);
+        default:
+            return visitor(NoShape());
+        }
+    }
+
+    CRect GetArea() const
+    {
+        return Visit([](const auto& shape) { return shape.GetArea(); });
+    }
+
+    long GetDistanceFrom(CPoint point) const
+    {
+        return Visit([&](const auto& shape) { return shape.GetDistanceFrom(point); });
+    }
+
+    std::vector<CPoint> GetPoints() const
+    {
+        return Visit([](const auto& shape) { return shape.GetPoints(); });
+    }
+
+    void Draw(CDC& dc) const
+    {
+        Visit([&](const auto& shape) { shape.Draw(dc); });
+    }
+};
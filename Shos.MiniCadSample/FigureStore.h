@@ -0,0 +1,301 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include "Figure.h"
+#include "undo_redo_vector.h"
+
+// Keeps the areas and shapes of the figures in parallel arrays aligned with their positions,
+// so that culling and hit-testing stream through memory instead of calling through each figure.
+// The figures stay authoritative; this is a cache of just what those loops read.
+// The arrays follow every edit in place and only read the figures that come in. A run of insertions or erasures,
+// such as a bulk step notifies, is queued and merged into the arrays in one pass, so it moves the positions behind it once.
+class FigureStore : private shos::undo_redo_pointer_vector<Figure>::observer
+{
+    // The shapes of one type. A figure keeps its slot while it stays; freed slots are reused.
+    template <typename TShape>
+    struct ShapePool
+    {
+        std::vector<TShape> shapes;
+        std::vector<size_t> freeIndices;
+
+        size_t Add(const TShape& shape)
+        {
+            if (freeIndices.empty()) {
+                shapes.push_back(shape);
+                return shapes.size() - 1;
+            }
+            auto index = freeIndices.back();
+            freeIndices.pop_back();
+            shapes[index] = shape;
+            return index;
+        }
+
+        void Remove(size_t index)
+        {
+            freeIndices.push_back(index);
+        }
+
+        void Clear()
+        {
+            shapes     .clear();
+            freeIndices.clear();
+        }
+    };
+
+    struct Entry
+    {
+        CRect      area;
+        FigureType type;
+        size_t     geometryIndex;
+    };
+
+    enum class Edit
+    {
+        None     ,
+        Insertion,
+        Erasure
+    };
+
+    shos::undo_redo_pointer_vector<Figure>&  figures;
+
+    std::vector<CRect>                       areas;
+    std::vector<FigureType>                  types;
+    std::vector<size_t>                      geometryIndices;
+
+    ShapePool<DotShape>                      dots;
+    ShapePool<LineShape>                     lines;
+    ShapePool<RectangleShape>                rectangles;
+    ShapePool<EllipseShape>                  ellipses;
+
+    // The queued run: ascending positions in the resulting arrays with the entries to insert there, or descending positions to erase.
+    Edit                                     pendingEdit;
+    std::vector<size_t>                      pendingIndices;
+    std::vector<Entry>                       pendingEntries;
+
+public:
+    FigureStore(shos::undo_redo_pointer_vector<Figure>& figures) : figures(figures), pendingEdit(Edit::None)
+    {
+        figures.add_observer(*this);
+    }
+
+    FigureStore(const FigureStore&) = delete;
+    FigureStore& operator =(const FigureStore&) = delete;
+
+    virtual ~FigureStore()
+    {
+        figures.remove_observer(*this);
+    }
+
+    const std::vector<CRect>& GetAreas()
+    {
+        Flush();
+        return areas;
+    }
+
+    long GetDistanceFrom(size_t index, CPoint point)
+    {
+        return Visit(index, [&](const auto& shape) { return shape.GetDistanceFrom(point); });
+    }
+
+    // Calls the visitor with the shape of the figure at the index, read from the array of its type.
+    template <typename TVisitor>
+    auto Visit(size_t index, TVisitor visitor) -> decltype(visitor(NoShape()))
+    {
+        Flush();
+        auto geometryIndex = geometryIndices[index];
+        switch (types[index]) {
+        case FigureType::Dot:
+            return visitor(dots.shapes[geometryIndex]);
+        case FigureType::Line:
+            return visitor(lines.shapes[geometryIndex]);
+        case FigureType::Rectangle:
+            return visitor(rectangles.shapes[geometryIndex]);
+        case FigureType::Ellipse:
+            return visitor(ellipses.shapes[geometryIndex]);
+        default:
+            return visitor(NoShape());
+        }
+    }
+
+private:
+    virtual void on_added(std::size_t index, Figure* const& figure) override
+    {
+        if (pendingEdit == Edit::Erasure || (pendingEdit == Edit::Insertion && index <= pendingIndices.back()))
+            Flush();
+
+        auto entry = ToEntry(*figure);
+        if (pendingEdit == Edit::None && index == areas.size()) {
+            Put(areas.size(), entry);
+            return;
+        }
+        pendingEdit = Edit::Insertion;
+        pendingIndices.push_back(index);
+        pendingEntries.push_back(entry);
+    }
+
+    virtual void on_removed(std::size_t index, Figure* const& /* figure */) override
+    {
+        if (pendingEdit == Edit::Insertion || (pendingEdit == Edit::Erasure && index >= pendingIndices.back()))
+            Flush();
+
+        // the positions queued so far are all behind this one, so it still refers to the arrays as they are
+        RemoveShape(types[index], geometryIndices[index]);
+        if (pendingEdit == Edit::None && index + 1 == areas.size()) {
+            areas          .pop_back();
+            types          .pop_back();
+            geometryIndices.pop_back();
+            return;
+        }
+        pendingEdit = Edit::Erasure;
+        pendingIndices.push_back(index);
+    }
+
+    virtual void on_updated(std::size_t index, Figure* const& /* oldFigure */, Figure* const& newFigure) override
+    {
+        Flush();
+        Set(index, *newFigure);
+    }
+
+    virtual void on_changing(std::size_t /* index */, Figure* const& /* figure */) override
+    {}
+
+    virtual void on_changed(std::size_t index, Figure* const& figure) override
+    {
+        Flush();
+        Set(index, *figure);
+    }
+
+    virtual void on_reset() override
+    {
+        areas          .clear();
+        types          .clear();
+        geometryIndices.clear();
+        dots           .Clear();
+        lines          .Clear();
+        rectangles     .Clear();
+        ellipses       .Clear();
+        pendingEdit = Edit::None;
+        pendingIndices.clear();
+        pendingEntries.clear();
+    }
+
+    // The collection changed without per-figure notifications, so every figure is read again.
+    virtual void on_reloaded() override
+    {
+        on_reset();
+        areas          .reserve(figures.size());
+        types          .reserve(figures.size());
+        geometryIndices.reserve(figures.size());
+        for (size_t index = 0; index < figures.size(); index++)
+            Put(index, ToEntry(*figures[index]));
+    }
+
+    void Flush()
+    {
+        switch (pendingEdit) {
+        case Edit::Insertion:
+            Insert();
+            break;
+        case Edit::Erasure:
+            Erase();
+            break;
+        default:
+            return;
+        }
+        pendingEdit = Edit::None;
+        pendingIndices.clear();
+        pendingEntries.clear();
+    }
+
+    // Fills the arrays from the back, moving each position once.
+    void Insert()
+    {
+        auto oldSize = areas.size();
+        Resize(oldSize + pendingIndices.size());
+        auto read    = oldSize;
+        auto write   = areas.size();
+        for (auto count = pendingIndices.size(); count > 0; ) {
+            --write;
+            if (pendingIndices[count - 1] == write)
+                Put(write, pendingEntries[--count]);
+            else
+                Move(--read, write);
+        }
+    }
+
+    // Closes the gaps from the lowest erased position on, moving each position once.
+    void Erase()
+    {
+        auto next  = pendingIndices.size();
+        auto write = pendingIndices.back();
+        for (auto read = write; read < areas.size(); read++) {
+            if (next > 0 && pendingIndices[next - 1] == read)
+                next--;
+            else
+                Move(read, write++);
+        }
+        Resize(write);
+    }
+
+    void Resize(size_t size)
+    {
+        areas          .resize(size);
+        types          .resize(size);
+        geometryIndices.resize(size);
+    }
+
+    void Move(size_t from, size_t to)
+    {
+        areas          [to] = areas          [from];
+        types          [to] = types          [from];
+        geometryIndices[to] = geometryIndices[from];
+    }
+
+    void Put(size_t index, const Entry& entry)
+    {
+        if (index == areas.size())
+            Resize(index + 1);
+        areas          [index] = entry.area;
+        types          [index] = entry.type;
+        geometryIndices[index] = entry.geometryIndex;
+    }
+
+    void Set(size_t index, const Figure& figure)
+    {
+        RemoveShape(types[index], geometryIndices[index]);
+        Put(index, ToEntry(figure));
+    }
+
+    Entry ToEntry(const Figure& figure)
+    {
+        auto shape = figure.GetShape();
+        return Entry { Figure::GetArea(shape, figure.Attribute()), shape.GetType(), shape.Visit([&](const auto& concreteShape) { return AddShape(concreteShape); }) };
+    }
+
+    size_t AddShape(const NoShape&       /* shape */) { return 0; }
+    size_t AddShape(const DotShape&       shape     ) { return dots      .Add(shape); }
+    size_t AddShape(const LineShape&      shape     ) { return lines     .Add(shape); }
+    size_t AddShape(const RectangleShape& shape     ) { return rectangles.Add(shape); }
+    size_t AddShape(const EllipseShape&   shape     ) { return ellipses  .Add(shape); }
+
+    void RemoveShape(FigureType type, size_t geometryIndex)
+    {
+        switch (type) {
+        case FigureType::Dot:
+            dots.Remove(geometryIndex);
+            break;
+        case FigureType::Line:
+            lines.Remove(geometryIndex);
+            break;
+        case FigureType::Rectangle:
+            rectangles.Remove(geometryIndex);
+            break;
+        case FigureType::Ellipse:
+            ellipses.Remove(geometryIndex);
+            break;
+        default:
+            break;
+        }
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <afx.h>
+#include <list>
+#include <unordered_map>
+#include <cstring>
+
+// Keeps the pens, brushes and fonts a view draws with, so a paint does not create and destroy one per figure.
+// Each kind keeps the most recently used objects; an object goes when capacity others have been used since.
+// The objects must not stay selected into a device context beyond the drawing that asked for them.
+class GdiObjectCache
+{
+    static const size_t capacity = 64;
+
+    // Byte-wise key: the bytes are hashed and compared as they are.
+    template <typename TKeyData>
+    struct Key
+    {
+        TKeyData data;
+
+        bool operator ==(const Key& key) const
+        {
+            return std::memcmp(&data, &key.data, sizeof(data)) == 0;
+        }
+
+        struct Hash
+        {
+            size_t operator ()(const Key& key) const
+            {
+                auto bytes = reinterpret_cast<const BYTE*>(&key.data);
+                auto hash  = size_t(14695981039346656037ULL);
+                for (size_t index = 0; index < sizeof(key.data); index++)
+                    hash = (hash ^ bytes[index]) * size_t(1099511628211ULL);
+                return hash;
+            }
+        };
+    };
+
+    template <typename TKey, typename TObject>
+    class LeastRecentlyUsedCache
+    {
+        struct Entry
+        {
+            TKey    key;
+            TObject object;
+        };
+
+        std::list<Entry>                                                                  entries;
+        std::unordered_map<TKey, typename std::list<Entry>::iterator, typename TKey::Hash> index;
+
+    public:
+        template <typename TCreate>
+        TObject& Get(const TKey& key, TCreate create)
+        {
+            auto found = index.find(key);
+            if (found != index.end()) {
+                entries.splice(entries.begin(), entries, found->second);
+                return found->second->object;
+            }
+
+            if (entries.size() == capacity) {
+                index.erase(entries.back().key);
+                entries.pop_back();
+            }
+            entries.emplace_front();
+            auto& entry = entries.front();
+            entry.key = key;
+            create(entry.object);
+            index[key] = entries.begin();
+            return entry.object;
+        }
+    };
+
+    struct PenData
+    {
+        int      style;
+        int      width;
+        COLORREF color;
+    };
+
+    using PenKey   = Key<PenData >;
+    using BrushKey = Key<COLORREF>;
+    using FontKey  = Key<LOGFONT >;
+
+    LeastRecentlyUsedCache<PenKey  , CPen  > pens;
+    LeastRecentlyUsedCache<BrushKey, CBrush> brushes;
+    LeastRecentlyUsedCache<FontKey , CFont > fonts;
+
+public:
+    CPen& GetPen(int style, int width, COLORREF color)
+    {
+        PenKey key;
+        std::memset(&key, 0, sizeof(key));
+        key.data.style = style;
+        key.data.width = width;
+        key.data.color = color;
+        return pens.Get(key, [&](CPen& pen) { pen.CreatePen(style, width, color); });
+    }
+
+    CBrush& GetBrush(COLORREF color)
+    {
+        BrushKey key;
+        key.data = color;
+        return brushes.Get(key, [&](CBrush& brush) { brush.CreateSolidBrush(color); });
+    }
+
+    // Fonts with the same metrics share one; the face name is compared up to its end.
+    CFont& GetFont(const LOGFONT& logFont)
+    {
+        FontKey key;
+        std::memset(&key, 0, sizeof(key));
+        key.data = logFont;
+        auto faceNameLength = ::lstrlen(logFont.lfFaceName);
+        std::memset(key.data.lfFaceName + faceNameLength, 0, (LF_FACESIZE - faceNameLength) * sizeof(TCHAR));
+        return fonts.Get(key, [&](CFont& font) { font.CreateFontIndirect(&key.data); });
+    }
+};
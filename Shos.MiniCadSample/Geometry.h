@@ -96,6 +96,12 @@ public:
     {
         return { rect.TopLeft(), CPoint(rect.right, rect.top), rect.BottomRight(), CPoint(rect.left, rect.bottom) };
     }
+
+    // The corners of the outline CDC::Rectangle draws for the rect, which leaves out the right and bottom edges.
+    static std::vector<CPoint> ToOutlinePoints(const CRect& rect)
+    {
+        return ToPoints(CRect(rect.left, rect.top, rect.right - 1, rect.bottom - 1));
+    }
     
     static bool GetArea(const std::vector<CRect>& areas, CRect& area)
     {
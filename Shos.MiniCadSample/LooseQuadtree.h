@@ -0,0 +1,178 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+
+template <typename TValue>
+class LooseQuadtree
+{
+    static const int maximumDepth = 8;
+
+    struct Entry
+    {
+        CRect  area;
+        TValue value;
+    };
+
+    struct Node
+    {
+        CRect              looseArea;
+        std::vector<Entry> entries;
+        Node*              children[4];
+
+        Node(const CRect& looseArea) : looseArea(looseArea), children()
+        {}
+
+        ~Node()
+        {
+            for (auto child : children)
+                delete child;
+        }
+    };
+
+    const CRect worldArea;
+    Node*       root;
+    size_t      count;
+
+public:
+    LooseQuadtree(const CRect& worldArea) : worldArea(worldArea), root(new Node(GetLooseArea(worldArea))), count(0)
+    {}
+
+    LooseQuadtree(const LooseQuadtree&) = delete;
+    LooseQuadtree& operator =(const LooseQuadtree&) = delete;
+
+    virtual ~LooseQuadtree()
+    {
+        delete root;
+    }
+
+    size_t Size() const
+    {
+        return count;
+    }
+
+    void Clear()
+    {
+        delete root;
+        root  = new Node(GetLooseArea(worldArea));
+        count = 0;
+    }
+
+    void Insert(const CRect& area, TValue value)
+    {
+        auto normalizedArea = Normalize(area);
+        GetNode(normalizedArea, true)->entries.push_back({ normalizedArea, value });
+        count++;
+    }
+
+    bool Remove(const CRect& area, TValue value)
+    {
+        auto normalizedArea = Normalize(area);
+        auto node           = GetNode(normalizedArea, false);
+        if (node == nullptr)
+            return false;
+
+        for (auto& entry : node->entries) {
+            if (entry.value == value && entry.area == normalizedArea) {
+                entry = node->entries.back();
+                node->entries.pop_back();
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename TFunction>
+    void Search(const CRect& area, TFunction function) const
+    {
+        SearchWhile(area, [&](TValue value) { function(value); return true; });
+    }
+
+    // Stops at the first entry the function returns false for, and returns whether it went through all of them.
+    template <typename TFunction>
+    bool SearchWhile(const CRect& area, TFunction function) const
+    {
+        return SearchWhile(*root, Normalize(area), function);
+    }
+
+private:
+    static CRect Normalize(CRect area)
+    {
+        area.NormalizeRect();
+        return area;
+    }
+
+    // A node's loose area is its cell enlarged by half the cell size on every side,
+    // so an entry fits into the deepest cell that contains its center and is not smaller than the entry.
+    static CRect GetLooseArea(const CRect& cell)
+    {
+        auto looseArea = cell;
+        looseArea.InflateRect((cell.Width() + 1) / 2, (cell.Height() + 1) / 2);
+        return looseArea;
+    }
+
+    static bool HasIntersection(const CRect& area1, const CRect& area2)
+    {
+        CRect intersection;
+        return intersection.IntersectRect(area1, area2) != FALSE;
+    }
+
+    Node* GetNode(const CRect& entryArea, bool create)
+    {
+        auto center = entryArea.CenterPoint();
+        if (!worldArea.PtInRect(center))
+            return root;
+
+        auto node = root;
+        auto cell = worldArea;
+        for (auto depth = 0; depth < maximumDepth; depth++) {
+            auto childCell = cell;
+            auto quadrant  = GetQuadrant(childCell, center);
+            if (entryArea.Width() > childCell.Width() || entryArea.Height() > childCell.Height() || childCell.IsRectEmpty())
+                break;
+
+            if (node->children[quadrant] == nullptr) {
+                if (!create)
+                    return nullptr;
+                node->children[quadrant] = new Node(GetLooseArea(childCell));
+            }
+            node = node->children[quadrant];
+            cell = childCell;
+        }
+        return node;
+    }
+
+    static int GetQuadrant(CRect& cell, CPoint point)
+    {
+        auto center   = cell.CenterPoint();
+        auto quadrant = 0;
+        if (point.x < center.x) {
+            cell.right = center.x;
+        } else {
+            cell.left = center.x;
+            quadrant |= 1;
+        }
+        if (point.y < center.y) {
+            cell.bottom = center.y;
+        } else {
+            cell.top = center.y;
+            quadrant |= 2;
+        }
+        return quadrant;
+    }
+
+    template <typename TFunction>
+    static bool SearchWhile(const Node& node, const CRect& area, TFunction& function)
+    {
+        for (const auto& entry : node.entries) {
+            if (HasIntersection(entry.area, area) && !function(entry.value))
+                return false;
+        }
+        for (auto child : node.children) {
+            if (child != nullptr && HasIntersection(child->looseArea, area) && !SearchWhile(*child, area, function))
+                return false;
+        }
+        return true;
+    }
+};
@@ -1,9 +1,18 @@
 #pragma once
 
 #include <afx.h>
+#include <random>
+#include <stdexcept>
 #include "Observer.h"
 #include "Figure.h"
+#include "FigureGenerator.h"
+#include "FigureSelection.h"
+#include "FigureStore.h"
+#include "FigureHistorySpiller.h"
+#include "FigureAttributePatch.h"
 #include "Application.h"
+#include "LooseQuadtree.h"
+#include "RTree.h"
 #include "undo_redo_vector.h"
 
 struct Hint : public CObject
@@ -14,10 +23,13 @@ struct Hint : public CObject
         Removed ,
         Changed ,
         All     ,
-        ViewOnly
+        ViewOnly,
+        Selected
     };
 
     std::vector<Figure*> figures;
+    // the former areas of figures changed in place, as they may have shrunk
+    std::vector<CRect>   areas;
     Type                 type;
 
     Hint(Type type) : type(type)
@@ -32,25 +44,167 @@ struct Hint : public CObject
     {}
 };
 
-class Model : public Observable<Hint>, public Observer<FigureAttribute>
+class Model : public Observable<Hint>, public Observer<FigureAttribute>, private shos::undo_redo_pointer_vector<Figure>::observer
 {
-    static const LONG size                   = 2000L;
-    static const LONG minimumLogicalAreaSize = size / 10L;
-
+    static const LONG   size                   = 2000L;
+    static const LONG   minimumLogicalAreaSize = size / 10L;
+    static const size_t maximumHistorySteps    = 10000;
+    static const size_t maximumHistoryBytes    = 256 * 1024 * 1024;
+    static const size_t residentHistorySteps   = 1000;
+    static const size_t checkpointInterval     = 1000;
+
+    FigureHistorySpiller                     historySpiller;
     shos::undo_redo_pointer_vector<Figure>   figures;
+    RTree<Figure*>                           figureTree;
+    LooseQuadtree<Figure*>                   figureQuadtree;
+    mutable shos::pointer_index_map<Figure>  figureIndices;
+    mutable FigureStore                      figureStore;
+    FigureSelection                          selection;
     const Figure* highlightedFigure;
 
     FigureAttribute currentFigureAttribute;
 
 public:
-    using iterator = shos::undo_redo_vector<Figure*>::const_iterator;
+    using iterator = shos::undo_redo_pointer_vector<Figure>::const_iterator;
+
+    // Single-pass range of the figures overlapping an area, in z-order.
+    class FigureRange
+    {
+        using Candidate = std::pair<size_t, Figure*>;
+
+        const Model&           model;
+        const CRect            area;
+        std::vector<Candidate> candidates;
+        bool                   isLinear;
+        size_t                 position;
+        Figure*                current;
+
+    public:
+        class iterator
+        {
+            FigureRange* range;
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = Figure*;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = Figure**;
+            using reference         = Figure*;
+
+            iterator(FigureRange* range) : range(range)
+            {}
+
+            Figure* operator *() const
+            {
+                return range->current;
+            }
+
+            iterator& operator ++()
+            {
+                range->Next();
+                return *this;
+            }
+
+            bool operator ==(const iterator& another) const
+            {
+                return IsEnd() == another.IsEnd();
+            }
+
+            bool operator !=(const iterator& another) const
+            {
+                return !(*this == another);
+            }
+
+        private:
+            bool IsEnd() const
+            {
+                return range == nullptr || range->current == nullptr;
+            }
+        };
+
+        FigureRange(const Model& model, const CRect& area)
+            : model(model), area(area), isLinear(false), position(0), current(nullptr)
+        {
+            // When most figures are visible, walking the figures in order is cheaper than sorting the candidates.
+            // So an area covering a quarter of the model is not searched, and the search gives up past a quarter of the figures.
+            auto maximumCount = model.figures.size() / 4;
+            isLinear = IsLarge(area) || !model.figureQuadtree.SearchWhile(area, [&](Figure* figure) {
+                if (candidates.size() == maximumCount)
+                    return false;
+                candidates.push_back(Candidate(0, figure));
+                return true;
+            });
+            if (isLinear) {
+                candidates.clear();
+            } else {
+                for (auto& candidate : candidates)
+                    VERIFY(model.figureIndices.find(candidate.second, candidate.first));
+                std::make_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+            }
+            Next();
+        }
+
+        iterator begin()
+        {
+            return iterator(this);
+        }
+
+        iterator end()
+        {
+            return iterator(nullptr);
+        }
+
+    private:
+        static bool IsLarge(CRect area)
+        {
+            area.NormalizeRect();
+            CRect modelArea = GetArea();
+            CRect visibleArea;
+            if (!visibleArea.IntersectRect(area, modelArea))
+                return false;
+            return static_cast<double>(visibleArea.Width()) * visibleArea.Height() * 4 >= static_cast<double>(modelArea.Width()) * modelArea.Height();
+        }
+
+        void Next()
+        {
+            current = isLinear ? NextInOrder() : NextCandidate();
+        }
+
+        Figure* NextInOrder()
+        {
+            const auto& areas = model.figureStore.GetAreas();
+            while (position < areas.size()) {
+                auto index = position++;
+                CRect intersection;
+                if (intersection.IntersectRect(areas[index], area))
+                    return model.figures[index];
+            }
+            return nullptr;
+        }
+
+        Figure* NextCandidate()
+        {
+            if (candidates.size() == 0)
+                return nullptr;
+
+            std::pop_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+            auto figure = candidates.back().second;
+            candidates.pop_back();
+            return figure;
+        }
+    };
 
     static const CSize GetMinimumSize() { return CSize(minimumLogicalAreaSize, minimumLogicalAreaSize); }
     static const CSize GetSize()        { return CSize(size, size); }
     static const CRect GetArea()        { return CRect(CPoint(), GetSize()); }
 
-    Model() : highlightedFigure(nullptr)
-    {}
+    Model() : figureQuadtree(GetArea()), figureIndices(figures), figureStore(figures), highlightedFigure(nullptr)
+    {
+        figures.add_observer(*this);
+        figures.set_history_limit(maximumHistorySteps, maximumHistoryBytes);
+        figures.set_spiller(&historySpiller, residentHistorySteps);
+        figures.set_checkpoint_interval(checkpointInterval);
+    }
 
     virtual ~Model()
     {
@@ -73,21 +227,28 @@ public:
         }
     }
 
+    // The figures are changed in place; the undo step only keeps their former attributes.
     void Update(std::vector<Figure*> selectedFigures, const FigureAttribute& figureAttribute)
     {
-        shos::undo_redo_vector<Figure*>::transaction transaction(figures);
+        Hint                hint(Hint::Type::Changed, selectedFigures);
+        std::vector<size_t> indices;
+        indices.reserve(selectedFigures.size());
         for (auto figure : selectedFigures) {
-            auto updatedFigure = figure->Clone();
-            updatedFigure->Attribute() = figureAttribute;
-            Update(*figure, *updatedFigure);
+            size_t index;
+            if (figureIndices.find(figure, index))
+                indices.push_back(index);
+            hint.areas.push_back(figure->GetArea());
         }
-        NotifyObservers(Hint(Hint::Type::Changed, selectedFigures));
+        std::sort(indices.begin(), indices.end());
+        auto count = indices.size();
+        figures.patch(std::move(indices), std::unique_ptr<FigureAttributePatch>(new FigureAttributePatch(figureAttribute, count)));
+        NotifyObservers(hint);
     }
 
     void Update(Figure& oldFigure, Figure& newFigure)
     {
-        auto iterator = std::find(figures.begin(), figures.end(), &oldFigure);
-        if (iterator != figures.cend())
+        auto iterator = Find(&oldFigure);
+        if (iterator != figures.end())
             figures.update(iterator, &newFigure);
     }
 
@@ -101,6 +262,11 @@ public:
         return figures.cend();
     }
 
+    FigureRange FiguresIn(const CRect& area) const
+    {
+        return FigureRange(*this, area);
+    }
+
     void Add(Figure* figure)
     {
         ASSERT_VALID(figure);
@@ -113,9 +279,12 @@ public:
     {
         ASSERT_VALID(figure);
 
-        auto iterator = std::find(figures.begin(), figures.end(), figure);
+        auto iterator = Find(figure);
+        if (iterator == figures.end())
+            return;
+
         figures.erase(iterator);
-        if ((*iterator)->IsSelected())
+        if (figure->IsSelected())
             SetSelectedFigureAttribute();
 
         NotifyObservers(Hint(Hint::Type::Removed, figure));
@@ -123,31 +292,48 @@ public:
 
     void RemoveSelectedFigures()
     {
-        shos::undo_redo_vector<Figure*>::transaction transaction(figures);
-        
         auto selectedFigures = GetSelectedFigures();
 
-        std::for_each(selectedFigures.cbegin(), selectedFigures.cend(),
-            [&](Figure* figure) {
-                auto iterator = std::find(figures.begin(), figures.end(), figure);
-                figures.erase(iterator);
-            });
+        std::vector<size_t> indices;
+        for (auto figure : selectedFigures) {
+            size_t index;
+            if (figureIndices.find(figure, index))
+                indices.push_back(index);
+        }
+        figures.erase(indices);
         SetSelectedFigureAttribute();
         NotifyObservers(Hint(Hint::Type::Removed, selectedFigures));
     }
 
     bool CanRemoveSelectedFigures() const
     {
-        for (auto iterator = figures.cbegin(); iterator != figures.cend(); iterator++) {
-            if ((*iterator)->IsSelected())
-                return true;
+        return !selection.IsEmpty();
+    }
+
+    // The selected figures in z-order.
+    std::vector<Figure*> GetSelectedFigures() const
+    {
+        using IndexedFigure = std::pair<size_t, Figure*>;
+
+        std::vector<IndexedFigure> indexedFigures;
+        indexedFigures.reserve(selection.Size());
+        for (auto figure : selection.GetFigures()) {
+            size_t index;
+            VERIFY(figureIndices.find(figure, index));
+            indexedFigures.push_back(IndexedFigure(index, figure));
         }
-        return false;
+        std::sort(indexedFigures.begin(), indexedFigures.end());
+
+        std::vector<Figure*> selectedFigures;
+        selectedFigures.reserve(indexedFigures.size());
+        for (const auto& indexedFigure : indexedFigures)
+            selectedFigures.push_back(indexedFigure.second);
+        return selectedFigures;
     }
     
     bool Change(Figure* oldFigure, Figure* newFigure)
     {
-        auto iterator = std::find(figures.begin(), figures.end(), oldFigure);
+        auto iterator = Find(oldFigure);
         if (iterator == figures.end())
             return false;
 
@@ -159,29 +345,37 @@ public:
 
     void Select(Figure& figure)
     {
-        figure.Select(!figure.IsSelected());
-        SetSelectedFigureAttribute();
+        Select(&figure, !figure.IsSelected());
+        SetSelectedFigureAttribute({ &figure });
     }
 
     void Select(const CRect& area)
     {
-        std::for_each(figures.begin(), figures.end(),
-                [&](Figure* figure) {
-                         figure->Select(Geometry::InRect(area, figure->GetArea()));
-                      });
-        SetSelectedFigureAttribute();
+        auto changedFigures = DeselectAll();
+        figureTree.Search(area,
+            [&](Figure* figure) {
+                if (Geometry::InRect(area, figure->GetArea())) {
+                    Select(figure, true);
+                    changedFigures.push_back(figure);
+                }
+            });
+        SetSelectedFigureAttribute(changedFigures);
     }
 
     void UnSelectAll()
     {
-        std::for_each(figures.cbegin(), figures.cend(), [](Figure* figure) { figure->Select(false); });
-        SetSelectedFigureAttribute();
+        SetSelectedFigureAttribute(DeselectAll());
     }
 
+    // The figures of an old step may have to be read back from the spill file; when that fails, nothing is undone.
     void Undo()
     {
-        if (figures.undo())
-            NotifyObservers(Hint(Hint::Type::All));
+        try {
+            if (figures.undo())
+                NotifyObservers(Hint(Hint::Type::All));
+        } catch (const std::runtime_error& error) {
+            ReportHistoryError(error);
+        }
     }
 
     bool CanUndo() const
@@ -200,6 +394,57 @@ public:
         return figures.can_redo();
     }
 
+    // Moves straight to a position in the history, the number of steps applied, with a single redraw.
+    void JumpTo(size_t historyPosition)
+    {
+        try {
+            if (figures.jump_to(historyPosition))
+                NotifyObservers(Hint(Hint::Type::All));
+        } catch (const std::runtime_error& error) {
+            ReportHistoryError(error);
+        }
+    }
+
+    size_t GetHistoryPosition() const
+    {
+        return figures.history_position();
+    }
+
+    size_t GetHistorySize() const
+    {
+        return figures.history_size();
+    }
+
+    Figure* GetNearestFigure(CPoint point, long searchingDistance, long* distance = nullptr) const
+    {
+        auto nearestFigures = GetNearestFigures(point, 1, searchingDistance);
+        if (distance != nullptr)
+            *distance = nearestFigures.size() == 0 ? 0L : nearestFigures[0].second;
+        return nearestFigures.size() == 0 ? nullptr : nearestFigures[0].first;
+    }
+
+    std::vector<std::pair<Figure*, long>> GetNearestFigures(CPoint point, size_t count, long searchingDistance) const
+    {
+        CRect searchingArea(point, point);
+        searchingArea.InflateRect(searchingDistance, searchingDistance);
+
+        return figureTree.GetNearest(point, count, searchingArea,
+            [&](Figure* figure) {
+                size_t index;
+                VERIFY(figureIndices.find(figure, index));
+                auto distance        = figureStore.GetDistanceFrom(index, point);
+                auto minimumDistance = RTree<Figure*>::GetMinimumDistance(point, figureStore.GetAreas()[index]);
+                return distance > minimumDistance ? distance : minimumDistance;
+            },
+            // a tie goes to the figure lowest in z-order, the one a scan from the front of the figures finds first
+            [&](Figure* figure1, Figure* figure2) {
+                size_t index1, index2;
+                VERIFY(figureIndices.find(figure1, index1));
+                VERIFY(figureIndices.find(figure2, index2));
+                return index1 < index2;
+            });
+    }
+
     void Hilight(const Figure* figure)
     {
         highlightedFigure = figure;
@@ -219,12 +464,23 @@ public:
         }
         else
         {
-            auto count = ar.ReadCount();
-            for (DWORD_PTR counter = 0L; counter < count; counter++) {
-                auto figure = STATIC_DOWNCAST(Figure, ar.ReadObject(NULL));
-                if (figure != nullptr)
-                    figures.push_back(figure);
+            // The figures go in as one bulk step, which is then dropped: an opened document starts with an empty history.
+            auto                 count = ar.ReadCount();
+            std::vector<Figure*> loadedFigures;
+            loadedFigures.reserve(count);
+            try {
+                for (DWORD_PTR counter = 0L; counter < count; counter++) {
+                    auto figure = STATIC_DOWNCAST(Figure, ar.ReadObject(NULL));
+                    if (figure != nullptr)
+                        loadedFigures.push_back(figure);
+                }
+            } catch (CException*) {
+                for (auto figure : loadedFigures)
+                    delete figure;
+                throw;
             }
+            figures.append(std::move(loadedFigures));
+            figures.clear_history();
         }
     }
 
@@ -233,50 +489,105 @@ public:
         figures.reset();
         UnSelectAll();
         highlightedFigure = nullptr;
+        FigurePool::Get().Trim();
     }
 
     void AddDummyData(size_t count)
     {
-        auto newFigures = FigureHelper::GetRandomFigures(count, GetArea());
-        std::for_each(newFigures.cbegin(), newFigures.cend(), [&](Figure* figure) { figures.push_back(figure); });
+        std::random_device random;
+        AddDummyData(FigureGenerator(GetArea(), (static_cast<ULONGLONG>(random()) << 32) | random()), 0, count);
+    }
+
+    void AddDummyData(const FigureGenerator& generator, size_t firstIndex, size_t count)
+    {
+        auto newFigures = generator.Generate(firstIndex, count);
+        figures.append(newFigures);
         NotifyObservers(Hint(Hint::Type::Added, newFigures));
     }
 
 private:
-    FigureAttribute GetSelectedFigureAttribute() const
+    virtual void on_added(std::size_t /* index */, Figure* const& figure) override
     {
-        auto selectedFigures = GetSelectedFigures();
+        auto area = figure->GetArea();
+        figureTree    .Insert(area, figure);
+        figureQuadtree.Insert(area, figure);
+        if (figure->IsSelected())
+            selection.Add(figure);
+    }
 
-        if (selectedFigures.size() == 1)
-            return selectedFigures[0]->Attribute();
-        if (selectedFigures.size() > 1)
-            return FigureAttribute::GetSum(GetSelectedFigureAttributes(selectedFigures));
-        return currentFigureAttribute;
+    virtual void on_removed(std::size_t /* index */, Figure* const& figure) override
+    {
+        auto area = figure->GetArea();
+        VERIFY(figureTree    .Remove(area, figure));
+        VERIFY(figureQuadtree.Remove(area, figure));
+        selection.Remove(figure);
     }
 
-    std::vector<FigureAttribute> GetSelectedFigureAttributes(const std::vector<Figure*> selectedFigures) const
+    virtual void on_reset() override
     {
-        std::vector<FigureAttribute> selectedFigureAttributes;
-        for (auto figure : selectedFigures)
-            selectedFigureAttributes.push_back(figure->Attribute());
-        return selectedFigureAttributes;
+        figureTree    .Clear();
+        figureQuadtree.Clear();
+        selection     .Clear();
     }
-    
-    void SetSelectedFigureAttribute()
+
+    virtual void on_reloaded() override
     {
-        Application::Set(GetSelectedFigureAttribute());
-        NotifyObservers(Hint(Hint::Type::ViewOnly));
+        on_reset();
+        for (auto figure : figures)
+            on_added(0, figure);
     }
 
-    std::vector<Figure*> GetSelectedFigures() const
+    void Select(Figure* figure, bool selected)
     {
-        std::vector<Figure*> selectedFigures;
-        std::for_each(figures.cbegin(), figures.cend(),
-            [&](Figure* figure) {
-                if (figure->IsSelected())
-                    selectedFigures.push_back(figure);
-            });
+        figure->Select(selected);
+        if (selected)
+            selection.Add(figure);
+        else
+            selection.Remove(figure);
+    }
 
+    std::vector<Figure*> DeselectAll()
+    {
+        auto selectedFigures = selection.GetFigures();
+        for (auto figure : selectedFigures)
+            Select(figure, false);
         return selectedFigures;
     }
+
+    static void ReportHistoryError(const std::runtime_error& error)
+    {
+        ::AfxMessageBox(CString(error.what()), MB_OK | MB_ICONERROR);
+    }
+
+    shos::undo_redo_pointer_vector<Figure>::iterator Find(Figure* figure)
+    {
+        size_t index;
+        return figureIndices.find(figure, index) ? std::next(figures.begin(), index) : figures.end();
+    }
+
+    FigureAttribute GetSelectedFigureAttribute() const
+    {
+        if (selection.IsEmpty())
+            return currentFigureAttribute;
+
+        // the selected figure lowest in z-order gives the values, as FigureAttribute::GetSum would take them
+        const Figure* firstFigure = nullptr;
+        size_t        firstIndex  = 0;
+        for (auto figure : selection.GetFigures()) {
+            size_t index;
+            VERIFY(figureIndices.find(figure, index));
+            if (firstFigure == nullptr || index < firstIndex) {
+                firstFigure = figure;
+                firstIndex  = index;
+            }
+        }
+        return selection.GetAttribute(*firstFigure);
+    }
+
+    // The hint only names the figures whose selection changed; their drawing stays as it is.
+    void SetSelectedFigureAttribute(std::vector<Figure*> changedFigures = std::vector<Figure*>())
+    {
+        Application::Set(GetSelectedFigureAttribute());
+        NotifyObservers(Hint(Hint::Type::Selected, changedFigures));
+    }
 };
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <afx.h>
+#include <vector>
+#include <queue>
+#include <limits>
+#include "Geometry.h"
+
+template <typename TValue>
+class RTree
+{
+    static const size_t maximumEntryCount = 16;
+    static const size_t minimumEntryCount = maximumEntryCount * 2 / 5;
+
+    struct Node;
+
+    struct Entry
+    {
+        CRect  area;
+        Node*  child;
+        TValue value;
+
+        Entry() : child(nullptr), value()
+        {}
+
+        Entry(const CRect& area, Node* child) : area(area), child(child), value()
+        {}
+
+        Entry(const CRect& area, TValue value) : area(area), child(nullptr), value(value)
+        {}
+    };
+
+    struct Node
+    {
+        bool               isLeaf;
+        std::vector<Entry> entries;
+
+        Node(bool isLeaf) : isLeaf(isLeaf)
+        {
+            entries.reserve(maximumEntryCount + 1);
+        }
+
+        ~Node()
+        {
+            for (auto& entry : entries)
+                delete entry.child;
+        }
+
+        CRect GetArea() const
+        {
+            CRect area = entries.size() == 0 ? CRect() : entries[0].area;
+            for (size_t index = 1; index < entries.size(); index++)
+                area.UnionRect(area, entries[index].area);
+            return area;
+        }
+    };
+
+    struct Candidate
+    {
+        double       distance;
+        const Entry* entry;
+
+        bool operator <(const Candidate& another) const
+        {
+            return distance > another.distance;
+        }
+    };
+
+    Node*  root;
+    size_t count;
+
+public:
+    RTree() : root(new Node(true)), count(0)
+    {}
+
+    RTree(const RTree&) = delete;
+    RTree& operator =(const RTree&) = delete;
+
+    virtual ~RTree()
+    {
+        delete root;
+    }
+
+    size_t Size() const
+    {
+        return count;
+    }
+
+    void Clear()
+    {
+        delete root;
+        root  = new Node(true);
+        count = 0;
+    }
+
+    void Insert(const CRect& area, TValue value)
+    {
+        Insert(Entry(Normalize(area), value));
+        count++;
+    }
+
+    bool Remove(const CRect& area, TValue value)
+    {
+        std::vector<Entry> orphans;
+        if (!Remove(*root, Normalize(area), value, orphans))
+            return false;
+
+        count--;
+        if (!root->isLeaf && root->entries.size() == 0) {
+            delete root;
+            root = new Node(true);
+        }
+        while (!root->isLeaf && root->entries.size() == 1) {
+            auto child = root->entries[0].child;
+            root->entries[0].child = nullptr;
+            delete root;
+            root = child;
+        }
+        for (const auto& orphan : orphans)
+            Insert(orphan);
+        return true;
+    }
+
+    template <typename TFunction>
+    void Search(const CRect& area, TFunction function) const
+    {
+        Search(*root, Normalize(area), function);
+    }
+
+    // Best-first branch-and-bound search over the entries intersecting the window.
+    // getDistance must not return less than GetMinimumDistance(point, area of the entry).
+    // Of the entries at the same distance, the ones isBefore(value1, value2) puts first come first.
+    template <typename TDistanceFunction, typename TOrderFunction>
+    std::vector<std::pair<TValue, long>> GetNearest(CPoint point, size_t maximumCount, const CRect& window, TDistanceFunction getDistance, TOrderFunction isBefore) const
+    {
+        std::vector<std::pair<TValue, long>> nearest;
+        if (maximumCount == 0 || count == 0)
+            return nearest;
+
+        std::priority_queue<Candidate> candidates;
+        Push(candidates, point, *root, window);
+
+        while (!candidates.empty()) {
+            auto candidate = candidates.top();
+            candidates.pop();
+
+            if (nearest.size() == maximumCount && candidate.distance > nearest.back().second)
+                break;
+
+            if (candidate.entry->child == nullptr)
+                Add(nearest, maximumCount, candidate.entry->value, getDistance(candidate.entry->value), isBefore);
+            else
+                Push(candidates, point, *candidate.entry->child, window);
+        }
+        return nearest;
+    }
+
+    static long GetMinimumDistance(CPoint point, const CRect& area)
+    {
+        return static_cast<long>(floor(GetDistance(point, area)));
+    }
+
+private:
+    static CRect Normalize(CRect area)
+    {
+        area.NormalizeRect();
+        return area;
+    }
+
+    static double GetDistance(CPoint point, const CRect& area)
+    {
+        auto dx = point.x < area.left ? area.left - point.x : (point.x > area.right  ? point.x - area.right  : 0L);
+        auto dy = point.y < area.top  ? area.top  - point.y : (point.y > area.bottom ? point.y - area.bottom : 0L);
+        return sqrt(Geometry::Square(static_cast<double>(dx)) + Geometry::Square(static_cast<double>(dy)));
+    }
+
+    static bool HasIntersection(const CRect& area1, const CRect& area2)
+    {
+        CRect intersection;
+        return intersection.IntersectRect(area1, area2) != FALSE;
+    }
+
+    static bool Contains(const CRect& outer, const CRect& inner)
+    {
+        return outer.left <= inner.left && outer.top <= inner.top && outer.right >= inner.right && outer.bottom >= inner.bottom;
+    }
+
+    static double GetSize(const CRect& area)
+    {
+        return static_cast<double>(area.Width()) * area.Height();
+    }
+
+    static double GetEnlargement(const CRect& area, const CRect& addition)
+    {
+        CRect unionArea;
+        unionArea.UnionRect(area, addition);
+        return GetSize(unionArea) - GetSize(area);
+    }
+
+    static void Push(std::priority_queue<Candidate>& candidates, CPoint point, const Node& node, const CRect& window)
+    {
+        for (const auto& entry : node.entries) {
+            if (HasIntersection(entry.area, window))
+                candidates.push({ GetDistance(point, entry.area), &entry });
+        }
+    }
+
+    template <typename TOrderFunction>
+    static void Add(std::vector<std::pair<TValue, long>>& nearest, size_t maximumCount, TValue value, long distance, TOrderFunction isBefore)
+    {
+        auto comesBefore = [&](const std::pair<TValue, long>& another) {
+            return distance < another.second || (distance == another.second && isBefore(value, another.first));
+        };
+        if (nearest.size() == maximumCount && !comesBefore(nearest.back()))
+            return;
+
+        auto iterator = nearest.begin();
+        while (iterator != nearest.end() && !comesBefore(*iterator))
+            iterator++;
+        nearest.insert(iterator, std::make_pair(value, distance));
+        if (nearest.size() > maximumCount)
+            nearest.pop_back();
+    }
+
+    void Insert(const Entry& entry)
+    {
+        auto sibling = Insert(*root, entry);
+        if (sibling != nullptr) {
+            auto newRoot = new Node(false);
+            newRoot->entries.push_back(Entry(root->GetArea(), root));
+            newRoot->entries.push_back(Entry(sibling->GetArea(), sibling));
+            root = newRoot;
+        }
+    }
+
+    static Node* Insert(Node& node, const Entry& entry)
+    {
+        if (node.isLeaf) {
+            node.entries.push_back(entry);
+        } else {
+            auto& chosen  = ChooseSubtree(node, entry.area);
+            auto  sibling = Insert(*chosen.child, entry);
+            chosen.area   = chosen.child->GetArea();
+            if (sibling != nullptr)
+                node.entries.push_back(Entry(sibling->GetArea(), sibling));
+        }
+        return node.entries.size() > maximumEntryCount ? Split(node) : nullptr;
+    }
+
+    static Entry& ChooseSubtree(Node& node, const CRect& area)
+    {
+        auto chosen = &node.entries[0];
+        auto minimumEnlargement = GetEnlargement(chosen->area, area);
+        for (size_t index = 1; index < node.entries.size(); index++) {
+            auto& entry       = node.entries[index];
+            auto  enlargement = GetEnlargement(entry.area, area);
+            if (enlargement < minimumEnlargement || (enlargement == minimumEnlargement && GetSize(entry.area) < GetSize(chosen->area))) {
+                minimumEnlargement = enlargement;
+                chosen             = &entry;
+            }
+        }
+        return *chosen;
+    }
+
+    // quadratic split
+    static Node* Split(Node& node)
+    {
+        std::vector<Entry> entries;
+        entries.swap(node.entries);
+
+        size_t seed1 = 0, seed2 = 1;
+        auto   maximumWaste = -std::numeric_limits<double>::infinity();
+        for (size_t index1 = 0; index1 < entries.size(); index1++) {
+            for (size_t index2 = index1 + 1; index2 < entries.size(); index2++) {
+                CRect unionArea;
+                unionArea.UnionRect(entries[index1].area, entries[index2].area);
+                auto waste = GetSize(unionArea) - GetSize(entries[index1].area) - GetSize(entries[index2].area);
+                if (waste > maximumWaste) {
+                    maximumWaste = waste;
+                    seed1        = index1;
+                    seed2        = index2;
+                }
+            }
+        }
+
+        auto sibling = new Node(node.isLeaf);
+        node    .entries.push_back(entries[seed1]);
+        sibling->entries.push_back(entries[seed2]);
+        auto area1 = entries[seed1].area;
+        auto area2 = entries[seed2].area;
+        entries.erase(entries.begin() + seed2);
+        entries.erase(entries.begin() + seed1);
+
+        while (!entries.empty()) {
+            if (node.entries.size() + entries.size() == minimumEntryCount) {
+                Move(entries, node.entries, area1);
+                break;
+            }
+            if (sibling->entries.size() + entries.size() == minimumEntryCount) {
+                Move(entries, sibling->entries, area2);
+                break;
+            }
+
+            size_t chosenIndex       = 0;
+            auto   maximumPreference = -1.0;
+            for (size_t index = 0; index < entries.size(); index++) {
+                auto preference = fabs(GetEnlargement(area1, entries[index].area) - GetEnlargement(area2, entries[index].area));
+                if (preference > maximumPreference) {
+                    maximumPreference = preference;
+                    chosenIndex       = index;
+                }
+            }
+
+            auto entry        = entries[chosenIndex];
+            entries.erase(entries.begin() + chosenIndex);
+            auto enlargement1 = GetEnlargement(area1, entry.area);
+            auto enlargement2 = GetEnlargement(area2, entry.area);
+            auto toFirst      = enlargement1 != enlargement2 ? enlargement1 < enlargement2
+                              : (GetSize(area1) != GetSize(area2) ? GetSize(area1) < GetSize(area2) : node.entries.size() <= sibling->entries.size());
+            if (toFirst) {
+                node.entries.push_back(entry);
+                area1.UnionRect(area1, entry.area);
+            } else {
+                sibling->entries.push_back(entry);
+                area2.UnionRect(area2, entry.area);
+            }
+        }
+        return sibling;
+    }
+
+    static void Move(std::vector<Entry>& source, std::vector<Entry>& destination, CRect& area)
+    {
+        for (const auto& entry : source) {
+            destination.push_back(entry);
+            area.UnionRect(area, entry.area);
+        }
+        source.clear();
+    }
+
+    bool Remove(Node& node, const CRect& area, TValue value, std::vector<Entry>& orphans)
+    {
+        if (node.isLeaf) {
+            for (auto iterator = node.entries.begin(); iterator != node.entries.end(); iterator++) {
+                if (iterator->value == value && iterator->area == area) {
+                    node.entries.erase(iterator);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        for (auto iterator = node.entries.begin(); iterator != node.entries.end(); iterator++) {
+            if (!Contains(iterator->area, area) || !Remove(*iterator->child, area, value, orphans))
+                continue;
+
+            auto child = iterator->child;
+            if (child->entries.size() < minimumEntryCount) {
+                CollectLeafEntries(*child, orphans);
+                delete child;
+                node.entries.erase(iterator);
+            } else {
+                iterator->area = child->GetArea();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static void CollectLeafEntries(Node& node, std::vector<Entry>& entries)
+    {
+        for (auto& entry : node.entries) {
+            if (node.isLeaf) {
+                entries.push_back(entry);
+            } else {
+                CollectLeafEntries(*entry.child, entries);
+                delete entry.child;
+                entry.child = nullptr;
+            }
+        }
+        node.entries.clear();
+    }
+
+    template <typename TFunction>
+    static void Search(const Node& node, const CRect& area, TFunction& function)
+    {
+        for (const auto& entry : node.entries) {
+            if (!HasIntersection(entry.area, area))
+                continue;
+            if (node.isLeaf)
+                function(entry.value);
+            else
+                Search(*entry.child, area, function);
+        }
+    }
+};
@@ -27,6 +27,7 @@ class View : public
     MouseEventTranslator::TestListener testListener;
 #endif // MOUSE_EVENT_TRANSLATOR_TEST
     MouseEventTranslator mouseEventTranslator;
+    GdiObjectCache       gdiObjectCache;
     
 public:
     View() : mouseEventTranslator(*this)
@@ -101,15 +102,23 @@ protected:
         DrawFigures(dc, GetDocument());
     }
 
+    virtual void OnDrawOverlay(CDC& dc) override
+    {
+        GetDocument().DrawSelection(dc, gdiObjectCache);
+    }
+
     virtual void OnDrawLayer2(CDC& dc)
     {
-        GetDocument().DrawCommand(dc);
+        GetDocument().DrawCommand(dc, gdiObjectCache);
     }
 
-    virtual void OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint) override
+    virtual CRect GetLayer2Area(CDC& dc) override
     {
-        Update();
+        return GetDocument().GetCommandArea(dc, gdiObjectCache);
+    }
 
+    virtual void OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint) override
+    {
         if (pHint == nullptr || static_cast<const Hint*>(pHint)->type == Hint::Type::All || static_cast<const Hint*>(pHint)->type == Hint::Type::ViewOnly) {
             #ifdef SCROLL_VIEW
             DoubleBufferScrollView
@@ -120,14 +129,25 @@ protected:
             return;
         }
 
-        CRect area;
-        FigureHelper::GetArea(static_cast<const Hint*>(pHint)->figures, area);
-        
-        TRACE(_T("View::OnUpdate: area   (top: %d, left: %d, width: %d, height: %d)\n"), area.top, area.left, area.Width(), area.Height());
-        area = LPtoDP(area);
-        TRACE(_T("View::OnUpdate: clipbox(top: %d, left: %d, width: %d, height: %d)\n"), area.top, area.left, area.Width(), area.Height());
-
-        InvalidateRect(area);
+        // only the areas of the figures are redrawn, each on its own, instead of their union
+        auto               hint  = static_cast<const Hint*>(pHint);
+        std::vector<CRect> areas = hint->areas;
+        areas.reserve(areas.size() + hint->figures.size());
+        for (auto figure : hint->figures)
+            areas.push_back(figure->GetArea());
+
+        CClientDC dc(this);
+        OnPrepareDC(&dc);
+        for (auto& area : areas) {
+            dc.LPtoDP(area);
+            area.NormalizeRect();
+            area.InflateRect(1, 1);
+        }
+        TRACE(_T("View::OnUpdate: %u areas\n"), static_cast<unsigned>(areas.size()));
+        if (hint->type == Hint::Type::Selected)
+            UpdateOverlay(areas);
+        else
+            Update(areas);
     }
 
     virtual void OnDragStart(UINT keys, CPoint point) override
@@ -159,12 +179,12 @@ protected:
 
     afx_msg void OnEditCopy()
     {
-        ClipboardHelper::OnEditCopy(GetDocument(), *this, GetDocument().GetSize(), GetBackgroundColor(), [&](CDC& dc) { GetDocument().Draw(dc); });
+        ClipboardHelper::OnEditCopy(GetDocument(), *this, GetDocument().GetSize(), GetBackgroundColor(), [&](CDC& dc) { GetDocument().Draw(dc, gdiObjectCache); });
     }
 
     afx_msg void OnEditCut()
     {
-        ClipboardHelper::OnEditCut(GetDocument(), *this, GetDocument().GetSize(), GetBackgroundColor(), [&](CDC& dc) { GetDocument().Draw(dc); });
+        ClipboardHelper::OnEditCut(GetDocument(), *this, GetDocument().GetSize(), GetBackgroundColor(), [&](CDC& dc) { GetDocument().Draw(dc, gdiObjectCache); });
     }
 
     afx_msg void OnEditPaste()
@@ -172,36 +192,42 @@ protected:
         ClipboardHelper::OnEditPaste(GetDocument(), *this);
     }
 
+    // The mouse only moves the overlays of layer 2, so only they are repainted.
     afx_msg void OnLButtonDown(UINT keys, CPoint point)
     {
         mouseEventTranslator.OnLButtonDown(keys, point);
+        UpdateLayer2();
     }
 
     afx_msg void OnLButtonUp(UINT keys, CPoint point)
     {
         mouseEventTranslator.OnLButtonUp(keys, point);
+        UpdateLayer2();
     }
 
     afx_msg void OnRButtonDown(UINT keys, CPoint point)
     {
         mouseEventTranslator.OnRButtonDown(keys, point);
+        UpdateLayer2();
     }
 
     afx_msg void OnRButtonUp(UINT keys, CPoint point)
     {
         mouseEventTranslator.OnRButtonUp(keys, point);
+        UpdateLayer2();
     }
 
     afx_msg void OnMouseMove(UINT keys, CPoint point)
     {
         TrackMouseLeaveEvent();
         mouseEventTranslator.OnMouseMove(keys, point);
-        Invalidate();
+        UpdateLayer2();
     }
     
     afx_msg LRESULT OnMouseLeave(WPARAM /* wParam */, LPARAM /* lParam */)
     {
         mouseEventTranslator.OnMouseLeave();
+        UpdateLayer2();
         return 0L;
     }
 
@@ -249,12 +275,12 @@ private:
         auto clippingMode = dc.GetClipBox(clipBox);
 
         if (clippingMode == SIMPLEREGION || clippingMode == COMPLEXREGION) {
-            dc.DPtoLP(clipBox);
-            for (auto figure : document) {
+            FigureBatch batch(dc, gdiObjectCache);
+            for (auto figure : document.FiguresIn(clipBox)) {
                 ASSERT_VALID(figure);
-                if (HasIntersection(*figure, clipBox))
-                    figure->Draw(dc);
+                batch.Add(*figure);
             }
+            batch.Flush();
         }
         else {
             ASSERT(false);
@@ -262,12 +288,6 @@ private:
         }
     }
 
-    bool HasIntersection(const Figure& figure, const CRect& clipBox)
-    {
-        CRect intersection;
-        return intersection.IntersectRect(figure.GetArea(), clipBox);
-    }
-
     CPoint DPtoLP(CPoint point)
     {
         return Geometry::DPtoLP(*this, point);
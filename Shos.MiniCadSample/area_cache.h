@@ -0,0 +1,51 @@
+#pragma once
+
+namespace shos {
+
+// Caches the bounds of a shape and the area they make with a margin, such as the pen width of a figure.
+// The owner calls invalidate when its geometry changes; a margin other than the one the area was made with only reinflates the kept bounds.
+// A copy starts empty, as the copy constructor of the owner may go on to change the geometry.
+template <typename TArea, typename TMargin>
+class area_cache
+{
+    TArea   shape_area;
+    TArea   area;
+    TMargin margin;
+    bool    is_shape_area_valid;
+
+public:
+    area_cache() : shape_area(), area(), margin(), is_shape_area_valid(false)
+    {}
+
+    area_cache(const area_cache& /* another */) : area_cache()
+    {}
+
+    area_cache& operator =(const area_cache& /* another */)
+    {
+        invalidate();
+        return *this;
+    }
+
+    void invalidate()
+    {
+        is_shape_area_valid = false;
+    }
+
+    // get_shape_area() gives the bounds of the shape, and inflate(bounds, margin) the area they make.
+    template <typename TGetShapeArea, typename TInflate>
+    const TArea& get(const TMargin& current_margin, TGetShapeArea get_shape_area, TInflate inflate)
+    {
+        if (!is_shape_area_valid) {
+            shape_area          = get_shape_area();
+            area                = inflate(shape_area, current_margin);
+            margin              = current_margin;
+            is_shape_area_valid = true;
+        } else if (!(margin == current_margin)) {
+            area                = inflate(shape_area, current_margin);
+            margin              = current_margin;
+        }
+        return area;
+    }
+};
+
+} // namespace shos
@@ -0,0 +1,494 @@
+#pragma once
+
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+namespace shos {
+
+// A sequence kept as a row of chunks that hold at most chunk_size elements each.
+// A position is found through a Fenwick tree over the chunk sizes in O(log n), after which an insertion or erasure moves the elements of one chunk only.
+// A chunk is split when it is full and merged with a neighbour when it runs low, which moves the row of chunks as well but happens at most once in chunk_size / 4 changes.
+// Iteration walks each chunk contiguously. As with std::vector, inserting or erasing invalidates all iterators.
+template <typename TElement, std::size_t chunk_size = 512>
+class chunked_vector
+{
+    static_assert(chunk_size >= 4, "chunk_size must be 4 or more");
+
+    using chunk = std::vector<TElement>;
+
+    std::vector<chunk>       chunks;
+    std::vector<std::size_t> tree; // the Fenwick tree, 1-based: tree[i] is the size sum of the chunks (i - lowbit(i), i]
+    std::size_t              count;
+
+    template <typename TValue, typename TOwner>
+    class basic_iterator
+    {
+        template <typename, typename>
+        friend class basic_iterator;
+        friend class chunked_vector;
+
+        TOwner*     owner;
+        std::size_t chunk_index;
+        std::size_t offset;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = TElement;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = TValue*;
+        using reference         = TValue&;
+
+        basic_iterator() : owner(nullptr), chunk_index(0), offset(0)
+        {}
+
+        basic_iterator(TOwner* owner, std::size_t chunk_index, std::size_t offset) : owner(owner), chunk_index(chunk_index), offset(offset)
+        {}
+
+        template <typename TOtherValue, typename TOtherOwner>
+        basic_iterator(const basic_iterator<TOtherValue, TOtherOwner>& other) : owner(other.owner), chunk_index(other.chunk_index), offset(other.offset)
+        {}
+
+        reference operator *() const
+        {
+            return owner->chunks[chunk_index][offset];
+        }
+
+        pointer operator ->() const
+        {
+            return &**this;
+        }
+
+        reference operator [](difference_type distance) const
+        {
+            return *(*this + distance);
+        }
+
+        basic_iterator& operator ++()
+        {
+            if (++offset == owner->chunks[chunk_index].size() && chunk_index + 1 < owner->chunks.size()) {
+                chunk_index++;
+                offset = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator& operator --()
+        {
+            if (offset == 0)
+                offset = owner->chunks[--chunk_index].size();
+            offset--;
+            return *this;
+        }
+
+        basic_iterator operator ++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        basic_iterator operator --(int)
+        {
+            auto old = *this;
+            --*this;
+            return old;
+        }
+
+        basic_iterator& operator +=(difference_type distance)
+        {
+            if (distance == 0)
+                return *this;
+            // stays within the chunk without a lookup when it can
+            if (distance > 0 ? offset + static_cast<std::size_t>(distance) < owner->chunks[chunk_index].size()
+                             : offset >= static_cast<std::size_t>(-distance))
+                offset = static_cast<std::size_t>(static_cast<difference_type>(offset) + distance);
+            else
+                owner->locate(static_cast<std::size_t>(static_cast<difference_type>(position()) + distance), chunk_index, offset);
+            return *this;
+        }
+
+        basic_iterator& operator -=(difference_type distance)
+        {
+            return *this += -distance;
+        }
+
+        basic_iterator operator +(difference_type distance) const
+        {
+            auto result = *this;
+            return result += distance;
+        }
+
+        friend basic_iterator operator +(difference_type distance, const basic_iterator& iterator)
+        {
+            return iterator + distance;
+        }
+
+        basic_iterator operator -(difference_type distance) const
+        {
+            auto result = *this;
+            return result -= distance;
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        difference_type operator -(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            if (chunk_index == other.chunk_index)
+                return static_cast<difference_type>(offset) - static_cast<difference_type>(other.offset);
+            return static_cast<difference_type>(position()) - static_cast<difference_type>(other.position());
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator ==(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return chunk_index == other.chunk_index && offset == other.offset;
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator !=(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return !(*this == other);
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator <(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return chunk_index < other.chunk_index || (chunk_index == other.chunk_index && offset < other.offset);
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator >(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return other < *this;
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator <=(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return !(other < *this);
+        }
+
+        template <typename TOtherValue, typename TOtherOwner>
+        bool operator >=(const basic_iterator<TOtherValue, TOtherOwner>& other) const
+        {
+            return !(*this < other);
+        }
+
+    private:
+        std::size_t position() const
+        {
+            return owner->prefix(chunk_index) + offset;
+        }
+    };
+
+public:
+    using value_type      = TElement;
+    using size_type       = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference       = TElement&;
+    using const_reference = const TElement&;
+    using iterator        = basic_iterator<TElement, chunked_vector>;
+    using const_iterator  = basic_iterator<const TElement, const chunked_vector>;
+
+    chunked_vector() : count(0)
+    {}
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    TElement& operator [](std::size_t index)
+    {
+        std::size_t chunk_index, offset;
+        locate(index, chunk_index, offset);
+        return chunks[chunk_index][offset];
+    }
+
+    const TElement& operator [](std::size_t index) const
+    {
+        std::size_t chunk_index, offset;
+        locate(index, chunk_index, offset);
+        return chunks[chunk_index][offset];
+    }
+
+    TElement& front()
+    {
+        return chunks.front().front();
+    }
+
+    const TElement& front() const
+    {
+        return chunks.front().front();
+    }
+
+    TElement& back()
+    {
+        return chunks.back().back();
+    }
+
+    const TElement& back() const
+    {
+        return chunks.back().back();
+    }
+
+    iterator begin()
+    {
+        return iterator(this, 0, 0);
+    }
+
+    iterator end()
+    {
+        return chunks.empty() ? iterator(this, 0, 0) : iterator(this, chunks.size() - 1, chunks.back().size());
+    }
+
+    const_iterator begin() const
+    {
+        return cbegin();
+    }
+
+    const_iterator end() const
+    {
+        return cend();
+    }
+
+    const_iterator cbegin() const
+    {
+        return const_iterator(this, 0, 0);
+    }
+
+    const_iterator cend() const
+    {
+        return chunks.empty() ? const_iterator(this, 0, 0) : const_iterator(this, chunks.size() - 1, chunks.back().size());
+    }
+
+    void push_back(const TElement& element)
+    {
+        emplace_back(element);
+    }
+
+    void push_back(TElement&& element)
+    {
+        emplace_back(std::move(element));
+    }
+
+    template <typename... TArguments>
+    void emplace_back(TArguments&&... arguments)
+    {
+        if (chunks.empty() || chunks.back().size() == chunk_size)
+            append_chunk();
+        chunks.back().emplace_back(std::forward<TArguments>(arguments)...);
+        increase(chunks.size() - 1, 1);
+    }
+
+    void pop_back()
+    {
+        erase(std::prev(cend()));
+    }
+
+    iterator insert(const_iterator position, const TElement& element)
+    {
+        return emplace(position, element);
+    }
+
+    iterator insert(const_iterator position, TElement&& element)
+    {
+        return emplace(position, std::move(element));
+    }
+
+    template <typename... TArguments>
+    iterator emplace(const_iterator position, TArguments&&... arguments)
+    {
+        if (chunks.empty()) {
+            emplace_back(std::forward<TArguments>(arguments)...);
+            return begin();
+        }
+
+        auto chunk_index = position.chunk_index;
+        auto offset      = position.offset;
+        if (chunks[chunk_index].size() == chunk_size) {
+            split(chunk_index);
+            if (offset > chunks[chunk_index].size()) {
+                offset -= chunks[chunk_index].size();
+                chunk_index++;
+            }
+        }
+        chunks[chunk_index].emplace(std::next(chunks[chunk_index].begin(), offset), std::forward<TArguments>(arguments)...);
+        increase(chunk_index, 1);
+        return iterator(this, chunk_index, offset);
+    }
+
+    iterator erase(const_iterator position)
+    {
+        return erase(position, std::next(position));
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        if (first == last)
+            return iterator(this, first.chunk_index, first.offset);
+
+        auto index  = first.position();
+        auto erased = static_cast<std::size_t>(last - first);
+        if (first.chunk_index == last.chunk_index) {
+            auto& chunk = chunks[first.chunk_index];
+            chunk.erase(std::next(chunk.begin(), first.offset), std::next(chunk.begin(), last.offset));
+            if (chunk.size() >= chunk_size / 4) {
+                decrease(first.chunk_index, erased);
+                return first.offset < chunk.size() || first.chunk_index + 1 == chunks.size() ? iterator(this, first.chunk_index, first.offset)
+                                                                                              : iterator(this, first.chunk_index + 1, 0);
+            }
+        } else {
+            // trims the ends first, so that the chunks in between can go in one move
+            auto& last_chunk  = chunks[last.chunk_index];
+            last_chunk.erase(last_chunk.begin(), std::next(last_chunk.begin(), last.offset));
+            auto& first_chunk = chunks[first.chunk_index];
+            first_chunk.erase(std::next(first_chunk.begin(), first.offset), first_chunk.end());
+            chunks.erase(std::next(chunks.begin(), first.chunk_index + 1), std::next(chunks.begin(), last.chunk_index));
+        }
+        count -= erased;
+
+        rebalance(first.chunk_index);
+        rebuild();
+        return begin() + index;
+    }
+
+    void resize(std::size_t new_size)
+    {
+        if (new_size < count) {
+            erase(cbegin() + new_size, cend());
+            return;
+        }
+        while (count < new_size) {
+            if (chunks.empty() || chunks.back().size() == chunk_size)
+                chunks.push_back(chunk());
+            auto& chunk = chunks.back();
+            auto  grown = (std::min)(chunk_size - chunk.size(), new_size - count);
+            chunk.reserve(chunk_size);
+            chunk.resize(chunk.size() + grown);
+            count += grown;
+        }
+        rebuild();
+    }
+
+    void clear()
+    {
+        chunks.clear();
+        tree.clear();
+        count = 0;
+    }
+
+private:
+    // Finds the chunk and the offset of the index; size() maps to the end of the last chunk.
+    void locate(std::size_t index, std::size_t& chunk_index, std::size_t& offset) const
+    {
+        if (index >= count) {
+            chunk_index = chunks.empty() ? 0 : chunks.size() - 1;
+            offset      = chunks.empty() ? 0 : chunks.back().size();
+            return;
+        }
+
+        std::size_t node = 0;
+        auto        step = std::size_t(1);
+        while (step * 2 <= chunks.size())
+            step *= 2;
+        for (; step > 0; step /= 2) {
+            if (node + step <= chunks.size() && tree[node + step] <= index) {
+                node  += step;
+                index -= tree[node];
+            }
+        }
+        chunk_index = node;
+        offset      = index;
+    }
+
+    // The number of elements in the chunks before chunk_index.
+    std::size_t prefix(std::size_t chunk_index) const
+    {
+        std::size_t sum = 0;
+        for (auto node = chunk_index; node > 0; node -= node & (~node + 1))
+            sum += tree[node];
+        return sum;
+    }
+
+    void increase(std::size_t chunk_index, std::size_t size)
+    {
+        for (auto node = chunk_index + 1; node <= chunks.size(); node += node & (~node + 1))
+            tree[node] += size;
+        count += size;
+    }
+
+    void decrease(std::size_t chunk_index, std::size_t size)
+    {
+        for (auto node = chunk_index + 1; node <= chunks.size(); node += node & (~node + 1))
+            tree[node] -= size;
+        count -= size;
+    }
+
+    void append_chunk()
+    {
+        chunks.push_back(chunk());
+        chunks.back().reserve(chunk_size);
+        if (tree.empty())
+            tree.push_back(0);
+        // the new node covers the chunks (node - lowbit(node), node], of which only the last one is empty
+        auto node = chunks.size();
+        tree.push_back(prefix(node - 1) - prefix(node - (node & (~node + 1))));
+    }
+
+    void split(std::size_t chunk_index)
+    {
+        auto& full  = chunks[chunk_index];
+        auto  half  = std::next(full.begin(), full.size() / 2);
+        chunk upper;
+        upper.reserve(chunk_size);
+        upper.insert(upper.end(), std::make_move_iterator(half), std::make_move_iterator(full.end()));
+        full.erase(half, full.end());
+        chunks.insert(std::next(chunks.begin(), chunk_index + 1), std::move(upper));
+        rebuild();
+    }
+
+    // Drops the chunks an erasure starting in the chunk has emptied, then merges the chunk with a neighbour when it runs low and both fit in one.
+    void rebalance(std::size_t chunk_index)
+    {
+        auto first = std::next(chunks.begin(), chunk_index);
+        auto last  = std::next(chunks.begin(), (std::min)(chunk_index + 2, chunks.size()));
+        chunks.erase(std::remove_if(first, last, [](const chunk& chunk) { return chunk.empty(); }), last);
+        if (chunk_index >= chunks.size() || chunks[chunk_index].size() >= chunk_size / 4)
+            return;
+
+        if (chunk_index + 1 < chunks.size() && chunks[chunk_index].size() + chunks[chunk_index + 1].size() <= chunk_size)
+            merge(chunk_index);
+        else if (chunk_index > 0 && chunks[chunk_index - 1].size() + chunks[chunk_index].size() <= chunk_size)
+            merge(chunk_index - 1);
+    }
+
+    // Moves the elements of the next chunk into the chunk and drops the next one.
+    void merge(std::size_t chunk_index)
+    {
+        auto& lower = chunks[chunk_index];
+        auto& upper = chunks[chunk_index + 1];
+        lower.reserve(chunk_size);
+        lower.insert(lower.end(), std::make_move_iterator(upper.begin()), std::make_move_iterator(upper.end()));
+        chunks.erase(std::next(chunks.begin(), chunk_index + 1));
+    }
+
+    void rebuild()
+    {
+        tree.assign(chunks.size() + 1, 0);
+        for (std::size_t node = 1; node <= chunks.size(); node++) {
+            tree[node] += chunks[node - 1].size();
+            auto parent = node + (node & (~node + 1));
+            if (parent <= chunks.size())
+                tree[parent] += tree[node];
+        }
+    }
+};
+
+} // namespace shos
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <cstdlib>
+#include <cstddef>
+#include <cassert>
+#include <new>
+
+namespace shos {
+
+// Size-class pools of small blocks. A block of up to granularity * class_number bytes comes from a free list of its class and goes back to it.
+// Each thread keeps free lists of its own and moves blocks between them and the shared ones batch_size at a time,
+// so the lock is taken once a batch and threads that allocate at the same time hardly wait for each other.
+// trim returns the chunks without live blocks to the heap; the blocks other threads keep count as live there.
+// The pool is to outlive its use on other threads.
+template <std::size_t granularity = 16, std::size_t class_number = 8, std::size_t chunk_size = 64 * 1024, std::size_t batch_size = 64>
+class size_class_pool
+{
+    static_assert(granularity >= sizeof(void*) && granularity % sizeof(void*) == 0, "granularity must be a multiple of the pointer size");
+    static_assert(chunk_size >= granularity * class_number, "chunk_size must hold a block of every class");
+    static_assert(batch_size > 0, "batch_size must be 1 or more");
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    struct free_list
+    {
+        free_block* head;
+        std::size_t count;
+
+        free_list() : head(nullptr), count(0)
+        {}
+
+        void push(void* pointer)
+        {
+            auto block  = static_cast<free_block*>(pointer);
+            block->next = head;
+            head        = block;
+            count++;
+        }
+
+        void* pop()
+        {
+            assert(head != nullptr);
+            auto block = head;
+            head       = head->next;
+            count--;
+            return block;
+        }
+
+        // Moves up to number blocks from the front of another list, and returns how many it moved.
+        std::size_t take(free_list& another, std::size_t number)
+        {
+            std::size_t moved = 0;
+            for (; moved < number && another.head != nullptr; moved++)
+                push(another.pop());
+            return moved;
+        }
+    };
+
+    // The blocks of one size class shared by the threads.
+    struct central_list
+    {
+        std::vector<unsigned char*> chunks;
+        free_list                   free_blocks;
+        unsigned char*              rest;
+        unsigned char*              rest_end;
+        std::size_t                 out_count; // the blocks in use or kept by the threads
+
+        central_list() : rest(nullptr), rest_end(nullptr), out_count(0)
+        {}
+    };
+
+    // The free lists of one thread for one pool. The pool is null once it has been destroyed.
+    struct thread_cache
+    {
+        size_class_pool* pool;
+        free_list        free_blocks[class_number];
+
+        thread_cache() : pool(nullptr)
+        {}
+    };
+
+    // The caches of one thread, which give their blocks back when it exits.
+    struct thread_caches
+    {
+        std::vector<std::unique_ptr<thread_cache>> caches;
+        thread_cache*                              last;
+
+        thread_caches() : last(nullptr)
+        {}
+
+        ~thread_caches()
+        {
+            for (auto& cache : caches) {
+                if (cache->pool != nullptr)
+                    cache->pool->unregister_cache(*cache);
+            }
+        }
+    };
+
+    std::mutex                 mutex;
+    central_list               central_lists[class_number];
+    std::vector<thread_cache*> caches;
+
+public:
+    size_class_pool()
+    {}
+
+    size_class_pool(const size_class_pool&) = delete;
+    size_class_pool& operator =(const size_class_pool&) = delete;
+
+    virtual ~size_class_pool()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto cache : caches) {
+            cache->pool = nullptr;
+            for (auto& free_blocks : cache->free_blocks)
+                free_blocks = free_list();
+        }
+        for (auto& central : central_lists)
+            release(central);
+    }
+
+    void* allocate(std::size_t size)
+    {
+        if (!is_pooled(size))
+            return allocate_from_heap(size);
+
+        auto  index       = get_size_class_index(size);
+        auto& free_blocks = get_cache().free_blocks[index];
+        if (free_blocks.head == nullptr)
+            refill(index, free_blocks);
+        return free_blocks.pop();
+    }
+
+    void deallocate(void* pointer, std::size_t size)
+    {
+        if (pointer == nullptr)
+            return;
+        if (!is_pooled(size)) {
+            std::free(pointer);
+            return;
+        }
+
+        auto  index       = get_size_class_index(size);
+        auto& free_blocks = get_cache().free_blocks[index];
+        free_blocks.push(pointer);
+        if (free_blocks.count >= 2 * batch_size) {
+            std::lock_guard<std::mutex> lock(mutex);
+            give_back(central_lists[index], free_blocks, batch_size);
+        }
+    }
+
+    // Takes time in proportion to the free blocks, so it is meant for after large removals, not for every one.
+    void trim()
+    {
+        auto& cache = get_cache();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t index = 0; index < class_number; index++) {
+            auto& central = central_lists[index];
+            give_back(central, cache.free_blocks[index], cache.free_blocks[index].count);
+            if (central.out_count == 0)
+                release(central);
+            else
+                release_free_chunks(central, get_block_size(index));
+        }
+    }
+
+    std::size_t live_count()
+    {
+        auto& cache = get_cache();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t count = 0;
+        for (std::size_t index = 0; index < class_number; index++) {
+            give_back(central_lists[index], cache.free_blocks[index], cache.free_blocks[index].count);
+            count += central_lists[index].out_count;
+        }
+        return count;
+    }
+
+private:
+    static bool is_pooled(std::size_t size)
+    {
+        return size != 0 && size <= granularity * class_number;
+    }
+
+    static std::size_t get_size_class_index(std::size_t size)
+    {
+        return (size - 1) / granularity;
+    }
+
+    static std::size_t get_block_size(std::size_t index)
+    {
+        return (index + 1) * granularity;
+    }
+
+    static void* allocate_from_heap(std::size_t size)
+    {
+        auto pointer = std::malloc(size == 0 ? 1 : size);
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+        return pointer;
+    }
+
+    thread_cache& get_cache()
+    {
+        static thread_local thread_caches this_thread_caches;
+        if (this_thread_caches.last != nullptr && this_thread_caches.last->pool == this)
+            return *this_thread_caches.last;
+
+        auto& own_caches = this_thread_caches.caches;
+        auto  iterator   = std::find_if(own_caches.begin(), own_caches.end(), [this](const std::unique_ptr<thread_cache>& cache) { return cache->pool == this; });
+        if (iterator == own_caches.end()) {
+            // reuses the cache of a pool that has been destroyed
+            iterator = std::find_if(own_caches.begin(), own_caches.end(), [](const std::unique_ptr<thread_cache>& cache) { return cache->pool == nullptr; });
+            if (iterator == own_caches.end()) {
+                own_caches.push_back(std::unique_ptr<thread_cache>(new thread_cache));
+                iterator = own_caches.end() - 1;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            caches.push_back(iterator->get());
+            (*iterator)->pool = this;
+        }
+        this_thread_caches.last = iterator->get();
+        return *this_thread_caches.last;
+    }
+
+    void unregister_cache(thread_cache& cache)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t index = 0; index < class_number; index++)
+            give_back(central_lists[index], cache.free_blocks[index], cache.free_blocks[index].count);
+        caches.erase(std::find(caches.begin(), caches.end(), &cache));
+        cache.pool = nullptr;
+    }
+
+    // Moves a batch from the shared list to the free list of a thread, carving it out of a chunk when the shared list is empty.
+    void refill(std::size_t index, free_list& free_blocks)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& central = central_lists[index];
+        auto  count   = free_blocks.take(central.free_blocks, batch_size);
+        if (count == 0) {
+            auto block_size = get_block_size(index);
+            if (central.rest == nullptr || central.rest + block_size > central.rest_end) {
+                central.chunks.reserve(central.chunks.size() + 1);
+                auto chunk = static_cast<unsigned char*>(allocate_from_heap(chunk_size));
+                central.chunks.push_back(chunk);
+                central.rest     = chunk;
+                central.rest_end = chunk + chunk_size;
+            }
+            count = (std::min)(batch_size, static_cast<std::size_t>(central.rest_end - central.rest) / block_size);
+            // pushed from the back, so that the blocks are handed out in address order
+            for (auto block = central.rest + count * block_size; block != central.rest; ) {
+                block -= block_size;
+                free_blocks.push(block);
+            }
+            central.rest += count * block_size;
+        }
+        central.out_count += count;
+    }
+
+    static void give_back(central_list& central, free_list& free_blocks, std::size_t number)
+    {
+        auto count = central.free_blocks.take(free_blocks, number);
+        assert(central.out_count >= count);
+        central.out_count -= count;
+    }
+
+    // Frees the chunks all of whose blocks are on the shared free list, and takes those blocks off it.
+    static void release_free_chunks(central_list& central, std::size_t block_size)
+    {
+        auto& chunks     = central.chunks;
+        auto  rest_chunk = central.rest == nullptr ? nullptr : central.rest_end - chunk_size;
+        std::sort(chunks.begin(), chunks.end());
+
+        std::vector<std::size_t> free_counts(chunks.size());
+        for (auto block = central.free_blocks.head; block != nullptr; block = block->next)
+            free_counts[find_chunk(chunks, block)]++;
+
+        std::vector<bool>           is_released(chunks.size());
+        std::vector<unsigned char*> kept_chunks;
+        for (std::size_t index = 0; index < chunks.size(); index++) {
+            auto chunk       = chunks[index];
+            auto block_count = chunk == rest_chunk ? static_cast<std::size_t>(central.rest - chunk) / block_size : chunk_size / block_size;
+            is_released[index] = free_counts[index] == block_count;
+            if (!is_released[index])
+                kept_chunks.push_back(chunk);
+        }
+        if (kept_chunks.size() == chunks.size())
+            return;
+
+        for (auto link = &central.free_blocks.head; *link != nullptr;) {
+            if (is_released[find_chunk(chunks, *link)]) {
+                *link = (*link)->next;
+                central.free_blocks.count--;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+        for (std::size_t index = 0; index < chunks.size(); index++) {
+            if (!is_released[index])
+                continue;
+            if (chunks[index] == rest_chunk)
+                central.rest = central.rest_end = nullptr;
+            std::free(chunks[index]);
+        }
+        chunks.swap(kept_chunks);
+    }
+
+    // The chunks are to be sorted.
+    static std::size_t find_chunk(const std::vector<unsigned char*>& chunks, const void* block)
+    {
+        auto iterator = std::upper_bound(chunks.begin(), chunks.end(), static_cast<const unsigned char*>(block));
+        assert(iterator != chunks.begin());
+        return static_cast<std::size_t>(iterator - chunks.begin()) - 1;
+    }
+
+    static void release(central_list& central)
+    {
+        for (auto chunk : central.chunks)
+            std::free(chunk);
+        central.chunks.clear();
+        central.free_blocks = free_list();
+        central.rest        = nullptr;
+        central.rest_end    = nullptr;
+    }
+};
+
+} // namespace shos
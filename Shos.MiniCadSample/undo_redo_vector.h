@@ -6,212 +6,358 @@
 #include <algorithm>
 #include <stdexcept>
 #include <functional>
+#include <unordered_map>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <memory>
+#include "chunked_vector.h"
 
 namespace shos {
 
-template <typename TElement, typename TCollection = std::vector<TElement>>
-class undo_redo_collection
+// Estimated bytes an undo step holds for an element it retains. A pointer retains its pointee too.
+template <typename TElement>
+struct retained_size
 {
-    class clean_up_function
+    static const std::size_t value = sizeof(TElement);
+};
+
+template <typename TElement>
+struct retained_size<TElement*>
+{
+    static const std::size_t value = sizeof(TElement*) + sizeof(TElement);
+};
+
+template <typename TElement>
+class collection_observer
+{
+public:
+    virtual ~collection_observer() {}
+
+    virtual void on_added  (std::size_t /* index */, const TElement& /* element */) {}
+    virtual void on_removed(std::size_t /* index */, const TElement& /* element */) {}
+    virtual void on_reset  () {}
+
+    virtual void on_updated(std::size_t index, const TElement& old_element, const TElement& new_element)
     {
-        std::function<void(TElement)> clean_up;
+        on_removed(index, old_element);
+        on_added  (index, new_element);
+    }
 
-    public:
-        clean_up_function(std::function<void(TElement)> clean_up) : clean_up(clean_up)
-        {}
+    // The whole content changed at once. Observers that keep state per element rebuild it from the collection.
+    virtual void on_reloaded()
+    {
+        on_reset();
+    }
 
-        void operator()(TElement element) const
-        {
-            clean_up(element);
-        }
-    };
+    // The element at the index is about to be changed in place by a patch, and has been. By default the element is removed before the change and added back after it.
+    virtual void on_changing(std::size_t index, const TElement& element)
+    {
+        on_removed(index, element);
+    }
 
-    class undo_step
+    virtual void on_changed(std::size_t index, const TElement& element)
     {
-    public:
-        enum class operation_type
-        {
-            add   ,
-            remove,
-            update,
-            group
-        };
-
-    private:
-        TCollection&                   collection;
-        operation_type                 operation;
-        std::size_t                    index;
-        TElement                       element;
-        bool                           hasElement;
-        const clean_up_function* const clean_up;
+        on_added(index, element);
+    }
+};
 
-    public:
-        operation_type get_operation_type()
-        {
-            return operation;
-        }
+// A change made to elements in place, recorded in the history instead of replacing them.
+// The patch holds a state for each element it changes and exchanges it with the element's own, so applying it again reverses the change.
+// Each application hands it the elements in order, from offset 0 to the last.
+template <typename TElement>
+class element_patch
+{
+public:
+    virtual ~element_patch() {}
 
-        TElement get_element() const
-        {
-            return element;
-        }
+    virtual void exchange(std::size_t offset, TElement& element) = 0;
 
-        virtual ~undo_step()
-        {
-            if (hasElement && clean_up != nullptr)
-                (*clean_up)(element);
-        }
-        
-        static undo_step* add(TCollection& collection, TElement element, const clean_up_function* clean_up = nullptr)
-        {
-            collection.push_back(element);
-            return new undo_step(collection, operation_type::add, collection.size() - 1, clean_up);
-        }
+    // Estimated bytes the patch holds.
+    virtual std::size_t footprint() const = 0;
 
-        static undo_step* remove(TCollection& collection, std::size_t index, const clean_up_function* clean_up = nullptr)
-        {
-            auto element = collection[index];
-            collection.erase(collection.begin() + index);
-            return new undo_step(collection, operation_type::remove, index, element, clean_up);
-        }
+    // Whether undoing this patch after the newer one, applied to the same elements, restores all the newer one changed, so the newer one can go when the two coalesce.
+    virtual bool covers(const element_patch& /* newer */) const
+    {
+        return false;
+    }
+};
 
-        static undo_step* update(TCollection& collection, std::size_t index, TElement element, const clean_up_function* clean_up = nullptr)
-        {
-            std::swap(element, collection[index]);
-            return new undo_step(collection, operation_type::update, index, element, clean_up);
-        }
+// Disposal policies. A collection hands an element it owns to its disposer when the element leaves both the collection and its history.
+// enabled() tells whether there is anything to do, so that a disabled policy skips the walk over the history altogether.
+template <typename TElement>
+class function_disposer
+{
+    std::function<void(TElement)> function;
 
-        virtual void undo()
-        {
-            switch (operation) {
-                case operation_type::add:
-                    operation  = operation_type::remove;
-                    element    = collection[index];
-                    hasElement = true;
-                    collection.erase(std::next(collection.begin(), index));
-                    break;
-                case operation_type::remove:
-                    collection.insert(std::next(collection.begin(), index), element);
-                    operation  = operation_type::add;
-                    hasElement = false;
-                    break;
-                case operation_type::update:
-                    std::swap(collection[index], element);
-                    break;
-            }
-        }
+public:
+    function_disposer()
+    {}
 
-        virtual void redo()
-        {
-            undo();
-        }
+    function_disposer(std::function<void(TElement)> function) : function(function)
+    {}
 
-        virtual const std::vector<undo_step*>* get_data() const
-        {
-            return nullptr;
-        }
+    bool enabled() const
+    {
+        return static_cast<bool>(function);
+    }
 
-    protected:
-        undo_step(TCollection& collection, operation_type operation, const clean_up_function* clean_up = nullptr)
-            : collection(collection), operation(operation), index(0), element(), hasElement(false), clean_up(clean_up)
-        {}
+    void operator()(TElement element) const
+    {
+        function(element);
+    }
+};
 
-    private:
-        undo_step(TCollection& collection, operation_type operation, std::size_t index, const clean_up_function* clean_up = nullptr)
-            : collection(collection), operation(operation), index(index), element(), hasElement(false), clean_up(clean_up)
-        {}
+struct delete_disposer
+{
+    bool enabled() const
+    {
+        return true;
+    }
 
-        undo_step(TCollection& collection, operation_type operation, std::size_t index, TElement element, const clean_up_function* clean_up = nullptr)
-            : collection(collection), operation(operation), index(index), element(element), hasElement(true), clean_up(clean_up)
-        {}
-    };
+    template <typename TElement>
+    void operator()(TElement* pointer) const
+    {
+        delete pointer;
+    }
+};
+
+struct null_disposer
+{
+    bool enabled() const
+    {
+        return false;
+    }
+
+    template <typename TElement>
+    void operator()(const TElement& /* element */) const
+    {}
+};
+
+// Whether a collection keeps its elements in one array, so that runs of trivially copyable elements can be moved as raw memory.
+template <typename TCollection>
+struct is_contiguous_collection : std::false_type
+{};
+
+template <typename TElement, typename TAllocator>
+struct is_contiguous_collection<std::vector<TElement, TAllocator>> : std::true_type
+{};
+
+template <typename TAllocator>
+struct is_contiguous_collection<std::vector<bool, TAllocator>> : std::false_type
+{};
+
+// Storage for the elements retained by cold undo steps, such as a file.
+// A spiller takes over the elements handed to it, so it disposes of them itself when they are discarded.
+template <typename TElement>
+class history_spiller
+{
+public:
+    virtual ~history_spiller() {}
 
-    class undo_step_group : public undo_step
+    // Takes over the elements and returns the key to restore them with.
+    virtual std::size_t spill(std::vector<TElement> elements) = 0;
+
+    // Gives back the elements spilled under the key, in their order, and forgets the key.
+    // Throws when they cannot be given back, keeping the key; the collection is then left as it was before the undo.
+    virtual std::vector<TElement> restore(std::size_t key) = 0;
+
+    // Disposes of the elements spilled under the key and forgets the key.
+    virtual void discard(std::size_t key) = 0;
+};
+
+template <typename TElement, typename TCollection = std::vector<TElement>, typename TDisposer = function_disposer<TElement>>
+class undo_redo_collection
+{
+public:
+    using observer = collection_observer<TElement>;
+
+private:
+    class observer_list
     {
-        std::vector<undo_step*> undo_steps;
+        std::vector<observer*> observers;
+        bool                   is_muted;
 
     public:
-        using iterator       = typename std::vector<undo_step*>::iterator;
-        using const_iterator = typename std::vector<undo_step*>::const_iterator;
-
-        undo_step_group(TCollection& collection) : undo_step(collection, undo_step::operation_type::group)
+        observer_list() : is_muted(false)
         {}
-        
-        virtual ~undo_step_group()
+
+        void mute(bool muted)
         {
-            for_each(undo_steps.begin(), undo_steps.end(), [](undo_step* step) { delete step; });
+            is_muted = muted;
         }
 
-        virtual const std::vector<undo_step*>* get_data() const override
+        void push_back(observer& observer)
         {
-            return &undo_steps;
+            observers.push_back(&observer);
         }
-        
-        size_t size() const
+
+        bool remove(observer& observer)
         {
-            return undo_steps.size();
+            auto iterator = std::find(observers.begin(), observers.end(), &observer);
+            if (iterator == observers.end())
+                return false;
+            observers.erase(iterator);
+            return true;
         }
 
-        void push_back(undo_step* step)
+        void added(std::size_t index, const TElement& element) const
         {
-            undo_steps.push_back(step);
+            if (is_muted)
+                return;
+            for (auto observer : observers)
+                observer->on_added(index, element);
         }
 
-        iterator begin()
+        void removed(std::size_t index, const TElement& element) const
         {
-            return undo_steps.begin();
+            if (is_muted)
+                return;
+            for (auto observer : observers)
+                observer->on_removed(index, element);
         }
 
-        iterator end()
+        void updated(std::size_t index, const TElement& old_element, const TElement& new_element) const
         {
-            return undo_steps.end();
+            if (is_muted)
+                return;
+            for (auto observer : observers)
+                observer->on_updated(index, old_element, new_element);
         }
 
-        const_iterator cbegin() const
+        void changing(std::size_t index, const TElement& element) const
         {
-            return undo_steps.cbegin();
+            if (is_muted)
+                return;
+            for (auto observer : observers)
+                observer->on_changing(index, element);
         }
 
-        const_iterator cend() const
+        void changed(std::size_t index, const TElement& element) const
         {
-            return undo_steps.cend();
+            if (is_muted)
+                return;
+            for (auto observer : observers)
+                observer->on_changed(index, element);
         }
 
-        virtual void undo() override
+        void reset() const
         {
-            for_each(undo_steps.rbegin(), undo_steps.rend(), [](undo_step* step) { step->undo(); });
+            for (auto observer : observers)
+                observer->on_reset();
         }
 
-        virtual void redo() override
+        void reloaded() const
+        {
+            for (auto observer : observers)
+                observer->on_reloaded();
+        }
+    };
+
+    // Bulk steps over trivially copyable elements in one array move the runs between the positions with memmove instead of element by element.
+    using uses_memory_ranges = std::integral_constant<bool, std::is_trivially_copyable<TElement>::value && is_contiguous_collection<TCollection>::value>;
+
+    enum class operation_type : unsigned char
+    {
+        add        ,
+        remove     ,
+        update     ,
+        bulk_add   ,
+        bulk_remove,
+        patch
+    };
+
+    // One record of the undo log. Undoing a record turns it into its inverse, so redoing is undoing again.
+    // has_element tells whether the record owns its elements, that is whether they are out of the collection; undo moves them in and out.
+    // An update record always owns element, the one it has replaced. While keeps_copies is set, a record keeps a copy of the elements
+    // it has applied as well, in element or, for an update, in other, so that it can be turned around without the collection.
+    // A bulk record refers to count entries from index on in bulk_indices and bulk_elements, a patch record to the entry at index in patches.
+    struct step_record
+    {
+        operation_type operation;
+        bool           has_element;
+        std::size_t    index;
+        std::size_t    count;
+        TElement       element;
+        TElement       other;
+
+        step_record(operation_type operation, std::size_t index, std::size_t count, TElement element, bool has_element, TElement other = TElement())
+            : operation(operation), has_element(has_element), index(index), count(count), element(std::move(element)), other(std::move(other))
+        {}
+
+        bool is_bulk() const
         {
-            for_each(undo_steps.begin(), undo_steps.end(), [](undo_step* step) { step->undo(); });
+            return operation == operation_type::bulk_add || operation == operation_type::bulk_remove;
         }
     };
 
+    // The ascending positions a patch record changes, copies of the elements there while keeps_copies is set, and the patch.
+    struct patch_entry
+    {
+        std::vector<std::size_t>                 indices;
+        std::vector<TElement>                    elements;
+        std::unique_ptr<element_patch<TElement>> patch;
+    };
+
+    // A copy of the collection after the steps before position, counted from the first step ever recorded, were applied.
+    struct checkpoint
+    {
+        std::size_t position;
+        TCollection data;
+    };
+
+    // An undo step is the range of records [begin, end); a transaction is simply a longer range.
+    // The elements a spilled step retains are held by the spiller under spill_key.
+    struct step_range
+    {
+        std::size_t begin;
+        std::size_t end;
+        bool        is_spilled;
+        std::size_t spill_key;
+    };
+
     TCollection                    data;
     size_t                         undo_steps_index;
-    std::vector<undo_step*>        undo_steps;
-    undo_step_group*               current_undo_step_group;
-    const clean_up_function* const clean_up;
+    std::vector<step_record>       records;
+    std::vector<step_range>        steps;
+    std::vector<std::size_t>       bulk_indices;
+    std::vector<TElement>          bulk_elements;
+    std::vector<patch_entry>       patches;
+    size_t                         first_step;
+    size_t                         dead_records;
+    bool                           in_transaction;
+    bool                           is_coalescing;
+    bool                           can_coalesce;
+    bool                           keeps_copies;
+    size_t                         transaction_begin;
+    const TDisposer                dispose;
+    observer_list                  observers;
+    size_t                         history_footprint;
+    size_t                         maximum_history_steps;
+    size_t                         maximum_history_bytes;
+    history_spiller<TElement>*     spiller;
+    size_t                         resident_steps;
+    size_t                         spilled_end;
+    std::vector<checkpoint>        checkpoints;
+    size_t                         checkpoint_interval;
 
 public:
     using iterator       = typename TCollection::iterator;
     using const_iterator = typename TCollection::const_iterator;
 
-    undo_redo_collection() : undo_steps_index(0), current_undo_step_group(nullptr), clean_up(nullptr)
+    undo_redo_collection(TDisposer dispose = TDisposer())
+        : undo_steps_index(0), first_step(0), dead_records(0), in_transaction(false), is_coalescing(false), can_coalesce(false), keeps_copies(false), transaction_begin(0), dispose(dispose)
+        , history_footprint(0), maximum_history_steps(0), maximum_history_bytes(0), spiller(nullptr), resident_steps(0), spilled_end(0)
+        , checkpoint_interval(0)
     {}
 
-    undo_redo_collection(std::function<void(TElement)> clean_up)
-        : undo_steps_index(0), current_undo_step_group(nullptr), clean_up(new clean_up_function(clean_up))
+    undo_redo_collection(std::function<void(TElement)> clean_up) : undo_redo_collection(TDisposer(clean_up))
     {}
 
     virtual ~undo_redo_collection()
     {
         reset_undo_steps();
-        if (clean_up != nullptr) {
-            clean_up_elements();
-            delete clean_up;
-        }
+        clean_up_elements();
     }
 
     const TElement& operator[](size_t index) const
@@ -246,55 +392,229 @@ public:
 
     void clear()
     {
-        transaction transaction(*this);
-        while (data.size() > 0)
-            erase(begin());
+        std::vector<std::size_t> indices(data.size());
+        for (std::size_t index = 0; index < indices.size(); index++)
+            indices[index] = index;
+        erase(std::move(indices));
     }
 
     void reset()
     {
         clean_up_elements();
         reset_undo_steps();
+        observers.reset();
+    }
+
+    // Drops the undo and redo steps and cleans up the elements they retain, keeping the collection as it is.
+    void clear_history()
+    {
+        if (in_transaction)
+            throw std::logic_error("an exception occurred");
+        reset_undo_steps();
+    }
+
+    void add_observer(observer& observer)
+    {
+        observers.push_back(observer);
+    }
+
+    bool remove_observer(observer& observer)
+    {
+        return observers.remove(observer);
     }
 
     void push_back(TElement element)
     {
-        auto step = undo_step::add(data, element, clean_up);
-        push(step);
+        emplace_back(std::move(element));
+    }
+
+    // Constructs the element in place at the back. The history copies it only while checkpoints are on.
+    template <typename... TArguments>
+    void emplace_back(TArguments&&... arguments)
+    {
+        begin_step();
+        data.emplace_back(std::forward<TArguments>(arguments)...);
+        push(step_record(operation_type::add, data.size() - 1, 0, copy_applied(data.back()), false));
+        observers.added(data.size() - 1, data.back());
     }
 
     void erase(iterator iterator)
     {
-        auto step = undo_step::remove(data, std::distance(data.begin(), iterator), clean_up);
-        push(step);
+        begin_step();
+        auto index   = static_cast<std::size_t>(std::distance(data.begin(), iterator));
+        auto element = std::move(*iterator);
+        data.erase(iterator);
+        observers.removed(index, element);
+        push(step_record(operation_type::remove, index, 0, std::move(element), true));
+    }
+
+    // Erases the elements at the given positions as a single undo step.
+    void erase(std::vector<std::size_t> indices)
+    {
+        std::sort(indices.begin(), indices.end());
+        if (std::adjacent_find(indices.begin(), indices.end()) != indices.end())
+            throw std::invalid_argument("duplicate index");
+        if (indices.empty())
+            return;
+        if (indices.back() >= data.size())
+            throw std::out_of_range("index out of range");
+
+        begin_step();
+        auto offset = bulk_indices.size();
+        bulk_indices .insert(bulk_indices.end(), indices.begin(), indices.end());
+        bulk_elements.resize(bulk_elements.size() + indices.size());
+        step_record record(operation_type::bulk_add, offset, indices.size(), TElement(), false);
+        undo(record);
+        push(std::move(record));
+    }
+
+    // Inserts the elements as a single undo step. The indices are their ascending positions in the resulting collection.
+    void insert(std::vector<std::size_t> indices, std::vector<TElement> elements)
+    {
+        if (indices.size() != elements.size())
+            throw std::invalid_argument("size mismatch");
+        if (std::adjacent_find(indices.begin(), indices.end(), std::greater_equal<std::size_t>()) != indices.end())
+            throw std::invalid_argument("indices are not ascending");
+        if (indices.empty())
+            return;
+        if (indices.back() >= data.size() + elements.size())
+            throw std::out_of_range("index out of range");
+
+        begin_step();
+        auto offset = bulk_indices.size();
+        bulk_indices .insert(bulk_indices .end(), indices.begin(), indices.end());
+        bulk_elements.insert(bulk_elements.end(), std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()));
+        step_record record(operation_type::bulk_remove, offset, indices.size(), TElement(), true);
+        undo(record);
+        push(std::move(record));
+    }
+
+    void append(std::vector<TElement> elements)
+    {
+        std::vector<std::size_t> indices(elements.size());
+        for (std::size_t index = 0; index < indices.size(); index++)
+            indices[index] = data.size() + index;
+        insert(std::move(indices), std::move(elements));
     }
 
     void update(iterator iterator, TElement element)
     {
-        auto step = undo_step::update(data, std::distance(data.begin(), iterator), element, clean_up);
-        push(step);
+        begin_step();
+        auto index = static_cast<std::size_t>(std::distance(data.begin(), iterator));
+        std::swap(element, *iterator);
+        observers.updated(index, element, *iterator);
+        push(step_record(operation_type::update, index, 0, std::move(element), true, copy_applied(*iterator)));
+    }
+
+    template <typename... TArguments>
+    void emplace_update(iterator iterator, TArguments&&... arguments)
+    {
+        update(iterator, TElement(std::forward<TArguments>(arguments)...));
+    }
+
+    // Changes the elements at the ascending positions in place as a single undo step. The patch is applied to them now, and again on undo and redo.
+    // Observers get on_changing and on_changed for each element instead of an update.
+    void patch(std::vector<std::size_t> indices, std::unique_ptr<element_patch<TElement>> patch)
+    {
+        if (patch == nullptr)
+            throw std::invalid_argument("no patch");
+        if (std::adjacent_find(indices.begin(), indices.end(), std::greater_equal<std::size_t>()) != indices.end())
+            throw std::invalid_argument("indices are not ascending");
+        if (indices.empty())
+            return;
+        if (indices.back() >= data.size())
+            throw std::out_of_range("index out of range");
+
+        begin_step();
+        auto count = indices.size();
+        patches.push_back(patch_entry { std::move(indices), std::vector<TElement>(keeps_copies ? count : 0), std::move(patch) });
+        step_record record(operation_type::patch, patches.size() - 1, count, TElement(), false);
+        apply_patch(record);
+        push(std::move(record));
     }
 
     bool undo()
     {
+        if (in_transaction)
+            throw std::logic_error("an exception occurred");
         if (undo_steps_index == 0)
             return false;
 
-        undo_steps[undo_steps_index - 1]->undo();
+        undo_step(first_step + undo_steps_index - 1, true);
         undo_steps_index--;
+        can_coalesce = false;
         return true;
     }
 
     bool redo()
     {
-        if (undo_steps_index == undo_steps.size())
+        if (in_transaction)
+            throw std::logic_error("an exception occurred");
+        if (undo_steps_index == history_size())
             return false;
 
-        undo_steps[undo_steps_index]->redo();
+        redo_step(first_step + undo_steps_index, true);
         undo_steps_index++;
+        can_coalesce = false;
+        spill_cold_steps();
         return true;
     }
 
+    // Moves to the history position, the number of applied steps, and notifies the observers once with on_reloaded.
+    // The walk starts from the nearest checkpoint when that is closer than the current position;
+    // the steps up to it only turn their records around, and the steps after it are replayed on the checkpoint.
+    bool jump_to(size_t position)
+    {
+        if (in_transaction)
+            throw std::logic_error("an exception occurred");
+        if (position > history_size())
+            throw std::out_of_range("position out of range");
+        if (position == undo_steps_index)
+            return false;
+
+        auto current = first_step + undo_steps_index;
+        auto target  = first_step + position;
+        auto nearest = find_checkpoint(target);
+        auto start   = nearest != checkpoints.end() && get_distance(nearest->position, target) < get_distance(current, target) ? nearest->position : current;
+
+        restore_spilled_steps((std::min)((std::min)(current, start), target));
+        observers.mute(true);
+        if (start != current) {
+            walk(current, start, false);
+            restore_checkpoint(*nearest, std::is_copy_constructible<TElement>());
+        }
+        walk(start, target, true);
+        observers.mute(false);
+
+        undo_steps_index = position;
+        can_coalesce     = false;
+        spill_cold_steps();
+        observers.reloaded();
+        return true;
+    }
+
+    size_t history_position() const
+    {
+        return undo_steps_index;
+    }
+
+    // Takes a checkpoint every interval steps. 0 turns checkpoints off.
+    // Each checkpoint holds a copy of the collection and counts towards history_bytes. The steps then keep copies of the elements they apply,
+    // so checkpoints need a copyable element and are turned on before the first step; otherwise the history only moves elements.
+    void set_checkpoint_interval(size_t interval)
+    {
+        if (interval != 0 && !std::is_copy_constructible<TElement>::value)
+            throw std::logic_error("an exception occurred");
+        if (history_size() == 0 && !in_transaction)
+            keeps_copies = interval != 0;
+        else if (interval != 0 && !keeps_copies)
+            throw std::logic_error("an exception occurred");
+
+        checkpoint_interval = interval;
+        if (interval == 0)
+            drop_checkpoints(checkpoints.begin(), checkpoints.end());
+    }
+
     bool can_undo() const
     {
         return undo_steps_index != 0;
@@ -302,15 +622,76 @@ public:
 
     bool can_redo() const
     {
-        return undo_steps_index != undo_steps.size();
+        return undo_steps_index != history_size();
+    }
+
+    // Caps the history. 0 leaves a limit off.
+    // When a new step exceeds a limit, the oldest steps are dropped and the elements they retain are cleaned up.
+    // The newest step is always kept, so a single step larger than the byte budget can still be undone.
+    void set_history_limit(size_t maximum_steps, size_t maximum_bytes = 0)
+    {
+        maximum_history_steps = maximum_steps;
+        maximum_history_bytes = maximum_bytes;
+        trim_undo_steps();
     }
 
+    size_t history_size() const
+    {
+        return steps.size() - first_step;
+    }
+
+    // Hands the elements retained by the applied steps older than the newest resident_steps over to the spiller.
+    // A step gets its elements back when undo reaches it. nullptr takes every spilled element back and stops spilling.
+    // The spiller must outlive the collection or be detached first.
+    void set_spiller(history_spiller<TElement>* spiller, size_t resident_steps)
+    {
+        if (this->spiller != nullptr)
+            restore_spilled_steps(first_step);
+        this->spiller        = spiller;
+        this->resident_steps = resident_steps;
+        spilled_end          = first_step;
+        spill_cold_steps();
+    }
+
+    // Estimated bytes held by the undo and redo steps, including the elements they retain.
+    size_t history_bytes() const
+    {
+        return history_footprint;
+    }
+
+    // Ends the current run of coalescing steps, so that the next coalescing step starts a new undo step.
+    void break_coalescing()
+    {
+        can_coalesce = false;
+    }
+
+    // A step recorded while a coalescing scope is open is merged into the newest step when that one was recorded in a coalescing scope too
+    // and both only update the same positions, such as the repeated changes of one gesture. The merged step keeps the first original elements;
+    // the intermediate ones are disposed of at once.
+    class coalescing
+    {
+        undo_redo_collection<TElement, TCollection, TDisposer>& collection;
+
+    public:
+        coalescing(undo_redo_collection<TElement, TCollection, TDisposer>& collection) : collection(collection)
+        {
+            if (collection.is_coalescing)
+                throw std::logic_error("an exception occurred");
+            collection.is_coalescing = true;
+        }
+
+        virtual ~coalescing()
+        {
+            collection.is_coalescing = false;
+        }
+    };
+
     class transaction
     {
-        undo_redo_collection<TElement, TCollection>& collection;
+        undo_redo_collection<TElement, TCollection, TDisposer>& collection;
         
     public:
-        transaction(undo_redo_collection<TElement, TCollection>& collection) : collection(collection)
+        transaction(undo_redo_collection<TElement, TCollection, TDisposer>& collection) : collection(collection)
         {
             collection.begin_transaction();
         }
@@ -324,96 +705,725 @@ public:
 private:
     void begin_transaction()
     {
-        if (current_undo_step_group != nullptr)
+        if (in_transaction)
             throw std::logic_error("an exception occurred");
 
-        current_undo_step_group = new undo_step_group(data);
+        in_transaction    = true;
+        transaction_begin = records.size();
     }
 
     void end_transaction()
     {
-        if (current_undo_step_group == nullptr)
+        if (!in_transaction)
             throw std::logic_error("an exception occurred");
 
-        if (current_undo_step_group->size() == 0)
-            delete current_undo_step_group;
-        else
-            push_to_steps(current_undo_step_group);
-        current_undo_step_group = nullptr;
+        in_transaction = false;
+        if (records.size() != transaction_begin)
+            commit_step(transaction_begin);
     }
-    
-    void push(undo_step* step)
+
+    // Called before a change is recorded. A new change makes the redo steps unreachable.
+    void begin_step()
     {
-        if (current_undo_step_group == nullptr)
-            push_to_steps(step);
-        else
-            push_to_group(step);
+        if (can_redo())
+            discard_redo_steps();
     }
 
-    void push_to_steps(undo_step* step)
+    void push(step_record&& record)
     {
-        if (undo_steps_index != undo_steps.size()) {
-            for_each(undo_steps.begin() + undo_steps_index, undo_steps.end(), [](undo_step* step) { delete step; });
-            undo_steps.erase(undo_steps.begin() + undo_steps_index, undo_steps.end());
-        }
+        records.push_back(std::move(record));
+        if (!in_transaction)
+            commit_step(records.size() - 1);
+    }
+
+    void commit_step(std::size_t begin)
+    {
+        if (is_coalescing && can_coalesce && coalesce(begin))
+            return;
 
-        undo_steps.push_back(step);
+        can_coalesce = is_coalescing;
+        steps.push_back(step_range { begin, records.size(), false, 0 });
         undo_steps_index++;
+        history_footprint += footprint(steps.back());
+        take_checkpoint();
+        trim_undo_steps();
+        spill_cold_steps();
     }
 
-    void push_to_group(undo_step* step)
+    // Merges the records from begin on into the newest step when they update the same distinct positions, or patch the same positions, in the same order.
+    // The older patch keeps the original states, so a newer one it covers simply goes.
+    bool coalesce(std::size_t begin)
     {
-        if (current_undo_step_group == nullptr)
-            throw std::logic_error("an exception occurred");
+        if (undo_steps_index == 0 || can_redo())
+            return false;
+
+        auto& last = steps[first_step + undo_steps_index - 1];
+        if (last.is_spilled || last.end != begin || last.end - last.begin != records.size() - begin)
+            return false;
+        for (std::size_t offset = 0; offset < records.size() - begin; offset++) {
+            const auto& older = records[last.begin + offset];
+            const auto& newer = records[begin      + offset];
+            if (older.operation == operation_type::update && newer.operation == operation_type::update && older.index == newer.index)
+                continue;
+            if (older.operation == operation_type::patch && newer.operation == operation_type::patch &&
+                patches[older.index].indices == patches[newer.index].indices && patches[older.index].patch->covers(*patches[newer.index].patch))
+                continue;
+            return false;
+        }
+        // with a position updated twice in the step, the element the first update applied would be lost
+        std::vector<std::size_t> indices;
+        for (auto index = begin; index < records.size(); index++) {
+            if (records[index].operation == operation_type::update)
+                indices.push_back(records[index].index);
+        }
+        std::sort(indices.begin(), indices.end());
+        if (std::adjacent_find(indices.begin(), indices.end()) != indices.end())
+            return false;
 
-        current_undo_step_group->push_back(step);
+        history_footprint -= footprint(last);
+        auto patch_size = patches.size();
+        for (std::size_t offset = 0; offset < records.size() - begin; offset++) {
+            auto& newer = records[begin + offset];
+            if (newer.operation == operation_type::patch) {
+                patches[records[last.begin + offset].index].elements = std::move(patches[newer.index].elements);
+                patch_size = (std::min)(patch_size, newer.index);
+                continue;
+            }
+            if (dispose.enabled())
+                dispose(newer.element);
+            records[last.begin + offset].other = std::move(newer.other);
+        }
+        records.erase(std::next(records.begin(), begin), records.end());
+        patches.erase(std::next(patches.begin(), patch_size), patches.end());
+        history_footprint += footprint(last);
+
+        // a checkpoint taken after the newest step holds the intermediate elements
+        if (!checkpoints.empty() && checkpoints.back().position == first_step + undo_steps_index)
+            drop_checkpoints(std::prev(checkpoints.end()), checkpoints.end());
+        return true;
+    }
+
+    void take_checkpoint()
+    {
+        auto position = first_step + undo_steps_index;
+        auto last     = checkpoints.empty() ? first_step : checkpoints.back().position;
+        if (checkpoint_interval == 0 || position - last < checkpoint_interval)
+            return;
+
+        add_checkpoint(position, std::is_copy_constructible<TElement>());
+    }
+
+    void add_checkpoint(std::size_t position, std::true_type /* copyable */)
+    {
+        checkpoints.push_back(checkpoint { position, data });
+        history_footprint += footprint(checkpoints.back());
+    }
+
+    // set_checkpoint_interval does not let a collection of move-only elements get here.
+    void add_checkpoint(std::size_t /* position */, std::false_type /* copyable */)
+    {}
+
+    void restore_checkpoint(const checkpoint& checkpoint, std::true_type /* copyable */)
+    {
+        data = checkpoint.data;
+    }
+
+    void restore_checkpoint(const checkpoint& /* checkpoint */, std::false_type /* copyable */)
+    {}
+
+    // A copy of the element to keep in a record while keeps_copies is set.
+    TElement copy_applied(const TElement& element) const
+    {
+        return keeps_copies ? duplicate(element, std::is_copy_constructible<TElement>()) : TElement();
+    }
+
+    // The element for the collection to take from a record; the record keeps a copy while keeps_copies is set.
+    TElement take(TElement& element) const
+    {
+        return keeps_copies ? duplicate(element, std::is_copy_constructible<TElement>()) : std::move(element);
+    }
+
+    static TElement duplicate(const TElement& element, std::true_type /* copyable */)
+    {
+        return element;
+    }
+
+    static TElement duplicate(const TElement& /* element */, std::false_type /* copyable */)
+    {
+        throw std::logic_error("an exception occurred");
+    }
+
+    static std::size_t footprint(const checkpoint& checkpoint)
+    {
+        return sizeof(checkpoint) + checkpoint.data.size() * sizeof(TElement);
+    }
+
+    void drop_checkpoints(typename std::vector<checkpoint>::iterator begin, typename std::vector<checkpoint>::iterator end)
+    {
+        std::for_each(begin, end, [&](const checkpoint& checkpoint) { history_footprint -= footprint(checkpoint); });
+        checkpoints.erase(begin, end);
     }
 
-    static void undo_data(const std::vector<undo_step*> undo_steps, std::vector<TElement>& undoes)
+    typename std::vector<checkpoint>::iterator find_checkpoint(std::size_t position)
     {
-        for (auto step : undo_steps) {
-            switch (step->get_operation_type()) {
-            case undo_step::operation_type::remove:
-            case undo_step::operation_type::update:
-                undoes.push_back(step->get_element());
+        auto next = std::lower_bound(checkpoints.begin(), checkpoints.end(), position, [](const checkpoint& checkpoint, std::size_t position) { return checkpoint.position < position; });
+        if (next == checkpoints.begin())
+            return next;
+        auto previous = std::prev(next);
+        return next == checkpoints.end() || get_distance(previous->position, position) <= get_distance(next->position, position) ? previous : next;
+    }
+
+    static std::size_t get_distance(std::size_t position1, std::size_t position2)
+    {
+        return position1 < position2 ? position2 - position1 : position1 - position2;
+    }
+
+    // Undoes or redoes the steps between the positions, on the collection or on the records alone.
+    void walk(std::size_t from, std::size_t to, bool on_data)
+    {
+        for (; from > to; from--)
+            undo_step(from - 1, on_data);
+        for (; from < to; from++)
+            redo_step(from, on_data);
+    }
+
+    void undo_step(std::size_t position, bool on_data)
+    {
+        if (position < spilled_end) {
+            restore_step(steps[position]);
+            spilled_end = position;
+        }
+
+        auto& step = steps[position];
+        history_footprint -= footprint(step);
+        for (auto index = step.end; index > step.begin; index--) {
+            if (on_data)
+                undo(records[index - 1]);
+            else
+                turn(records[index - 1]);
+        }
+        history_footprint += footprint(step);
+    }
+
+    void redo_step(std::size_t position, bool on_data)
+    {
+        auto& step = steps[position];
+        history_footprint -= footprint(step);
+        for (auto index = step.begin; index < step.end; index++) {
+            if (on_data)
+                undo(records[index]);
+            else
+                turn(records[index]);
+        }
+        history_footprint += footprint(step);
+    }
+
+    void undo(step_record& record)
+    {
+        switch (record.operation) {
+            case operation_type::add:
+                {
+                    // the copy a record keeps may be stale, as a spiller can give back other objects than it took
+                    auto position = std::next(data.begin(), record.index);
+                    record.element = std::move(*position);
+                    data.erase(position);
+                    observers.removed(record.index, record.element);
+                }
+                break;
+            case operation_type::remove:
+                {
+                    auto position = data.insert(std::next(data.begin(), record.index), take(record.element));
+                    observers.added(record.index, *position);
+                }
+                break;
+            case operation_type::update:
+                {
+                    auto& slot = *std::next(data.begin(), record.index);
+                    if (keeps_copies) {
+                        record.other = std::move(slot);
+                        slot         = take(record.element);
+                        observers.updated(record.index, record.other, slot);
+                    } else {
+                        std::swap(record.element, slot);
+                        observers.updated(record.index, record.element, slot);
+                    }
+                }
+                break;
+            case operation_type::bulk_add:
+                remove_elements(record, uses_memory_ranges());
+                break;
+            case operation_type::bulk_remove:
+                insert_elements(record, uses_memory_ranges());
+                break;
+            case operation_type::patch:
+                apply_patch(record);
+                return;
+        }
+        turn(record);
+    }
+
+    void apply_patch(const step_record& record)
+    {
+        auto& entry    = patches[record.index];
+        auto  position = data.begin();
+        auto  at       = std::size_t(0);
+        for (std::size_t offset = 0; offset < record.count; offset++) {
+            auto index = entry.indices[offset];
+            std::advance(position, index - at);
+            at = index;
+            observers.changing(index, *position);
+            entry.patch->exchange(offset, *position);
+            if (keeps_copies)
+                entry.elements[offset] = duplicate(*position, std::is_copy_constructible<TElement>());
+            observers.changed(index, *position);
+        }
+    }
+
+    // Turns the record into its inverse without touching the collection.
+    // Without copies an update has nothing to turn: undo has swapped its element with the collection already.
+    // A patch is its own inverse, but it is applied to the copies, which may share their state with the elements, as pointers do.
+    void turn(step_record& record)
+    {
+        switch (record.operation) {
+            case operation_type::add:
+                record.operation = operation_type::remove;
                 break;
-            case undo_step::operation_type::group:
-                if (step->get_data() != nullptr)
-                    undo_data(*step->get_data(), undoes);
+            case operation_type::remove:
+                record.operation = operation_type::add;
                 break;
+            case operation_type::update:
+                if (keeps_copies)
+                    std::swap(record.element, record.other);
+                return;
+            case operation_type::patch:
+                {
+                    auto& entry = patches[record.index];
+                    for (std::size_t offset = 0; offset < entry.elements.size(); offset++)
+                        entry.patch->exchange(offset, entry.elements[offset]);
+                }
+                return;
+            case operation_type::bulk_add:
+                record.operation = operation_type::bulk_remove;
+                break;
+            case operation_type::bulk_remove:
+                record.operation = operation_type::bulk_add;
+                break;
+        }
+        record.has_element = !record.has_element;
+    }
+
+    // Moves the elements at the ascending positions of the record into its slots in one pass over the collection.
+    // Observers are notified per element as if the elements were removed from the back.
+    void remove_elements(const step_record& record, std::false_type /* uses_memory_ranges */)
+    {
+        auto indices  = std::next(bulk_indices .begin(), record.index);
+        auto elements = std::next(bulk_elements.begin(), record.index);
+        auto write    = std::next(data.begin(), indices[0]);
+        auto position = indices[0];
+        auto count    = std::size_t(0);
+        for (auto read = write; read != data.end(); read++, position++) {
+            if (count < record.count && indices[count] == position)
+                elements[count++] = std::move(*read);
+            else
+                *write++ = std::move(*read);
+        }
+        data.erase(write, data.end());
+
+        for (auto index = record.count; index > 0; index--)
+            observers.removed(indices[index - 1], elements[index - 1]);
+    }
+
+    // Moves the elements of the record back to their positions, filling the collection from the back.
+    // Observers are notified per element as if the elements were added from the front.
+    void insert_elements(const step_record& record, std::false_type /* uses_memory_ranges */)
+    {
+        auto indices  = std::next(bulk_indices .begin(), record.index);
+        auto elements = std::next(bulk_elements.begin(), record.index);
+        auto oldSize  = data.size();
+        data.resize(oldSize + record.count);
+        auto read     = std::next(data.begin(), oldSize);
+        auto write    = data.end();
+        auto position = data.size();
+        std::vector<const TElement*> inserted(record.count);
+        for (auto count = record.count; count > 0; ) {
+            --write;
+            --position;
+            if (indices[count - 1] == position) {
+                *write = take(elements[--count]);
+                inserted[count] = &*write;
+            } else {
+                *write = std::move(*--read);
             }
         }
+
+        for (std::size_t index = 0; index < record.count; index++)
+            observers.added(indices[index], *inserted[index]);
     }
 
-    void reset_undo_steps()
+    // The same as above, a run of the elements between two positions at a time.
+    void remove_elements(const step_record& record, std::true_type /* uses_memory_ranges */)
     {
-        for_each(undo_steps.begin(), undo_steps.end(), [](undo_step* step) { delete step; });
-        undo_steps.clear();
+        auto indices  = bulk_indices .data() + record.index;
+        auto elements = bulk_elements.data() + record.index;
+        auto base     = data.data();
+        auto write    = indices[0];
+        for (std::size_t count = 0; count < record.count; count++) {
+            elements[count] = base[indices[count]];
+            auto run_begin = indices[count] + 1;
+            auto run_end   = count + 1 < record.count ? indices[count + 1] : data.size();
+            std::memmove(base + write, base + run_begin, (run_end - run_begin) * sizeof(TElement));
+            write += run_end - run_begin;
+        }
+        data.resize(write);
 
-        delete current_undo_step_group;
-        current_undo_step_group = nullptr;
-        undo_steps_index        = 0;
+        for (auto index = record.count; index > 0; index--)
+            observers.removed(indices[index - 1], elements[index - 1]);
+    }
+
+    void insert_elements(const step_record& record, std::true_type /* uses_memory_ranges */)
+    {
+        auto indices  = bulk_indices .data() + record.index;
+        auto elements = bulk_elements.data() + record.index;
+        auto read_end = data.size();
+        data.resize(data.size() + record.count);
+        auto base      = data.data();
+        auto write_end = data.size();
+        for (auto count = record.count; count > 0; count--) {
+            auto index = indices[count - 1];
+            auto run   = write_end - index - 1;
+            std::memmove(base + index + 1, base + read_end - run, run * sizeof(TElement));
+            read_end   -= run;
+            base[index] = elements[count - 1];
+            write_end   = index;
+        }
+
+        for (std::size_t index = 0; index < record.count; index++)
+            observers.added(indices[index], base[indices[index]]);
+    }
+
+    std::size_t footprint(const step_range& step) const
+    {
+        const auto retained = retained_size<TElement>::value - sizeof(TElement);
+
+        auto size = sizeof(step_range) + (step.end - step.begin) * sizeof(step_record);
+        for (auto index = step.begin; index < step.end; index++) {
+            const auto& record = records[index];
+            auto is_resident = record.has_element && !step.is_spilled;
+            if (record.is_bulk())
+                size += record.count * (sizeof(std::size_t) + sizeof(TElement) + (is_resident ? retained : 0));
+            else if (record.operation == operation_type::patch)
+                size += footprint(patches[record.index]);
+            else if (is_resident)
+                size += retained;
+        }
+        return size;
+    }
+
+    static std::size_t footprint(const patch_entry& entry)
+    {
+        return sizeof(patch_entry) + entry.indices.size() * sizeof(std::size_t) + entry.elements.size() * sizeof(TElement) + entry.patch->footprint();
+    }
+
+    void clean_up_records(std::size_t begin, std::size_t end)
+    {
+        if (!dispose.enabled())
+            return;
+
+        for (auto index = begin; index < end; index++) {
+            const auto& record = records[index];
+            if (!record.has_element)
+                continue;
+            if (record.is_bulk())
+                std::for_each(std::next(bulk_elements.begin(), record.index), std::next(bulk_elements.begin(), record.index + record.count), dispose);
+            else
+                dispose(record.element);
+        }
+    }
+
+    void clean_up_step(const step_range& step)
+    {
+        if (step.is_spilled)
+            spiller->discard(step.spill_key);
+        else
+            clean_up_records(step.begin, step.end);
+    }
+
+    // Calls the action with every element the records of the step retain, in record order.
+    template <typename TAction>
+    void for_each_retained(const step_range& step, TAction action)
+    {
+        for (auto index = step.begin; index < step.end; index++) {
+            auto& record = records[index];
+            if (!record.has_element)
+                continue;
+            if (record.is_bulk())
+                std::for_each(std::next(bulk_elements.begin(), record.index), std::next(bulk_elements.begin(), record.index + record.count), action);
+            else
+                action(record.element);
+        }
+    }
+
+    void spill_cold_steps()
+    {
+        if (spiller == nullptr || undo_steps_index <= resident_steps)
+            return;
+
+        spilled_end = (std::max)(spilled_end, first_step);
+        for (auto cold_end = first_step + undo_steps_index - resident_steps; spilled_end < cold_end; spilled_end++) {
+            // a spiller may give other objects back, so the checkpoints still holding the spilled elements have to go
+            if (spill_step(steps[spilled_end]))
+                drop_checkpoints(checkpoints.begin(), std::upper_bound(checkpoints.begin(), checkpoints.end(), spilled_end, [](std::size_t position, const checkpoint& checkpoint) { return position < checkpoint.position; }));
+        }
+    }
+
+    bool spill_step(step_range& step)
+    {
+        std::vector<TElement> elements;
+        for_each_retained(step, [&](TElement& element) {
+            elements.push_back(std::move(element));
+            element = TElement();
+        });
+        if (elements.empty())
+            return false;
+
+        history_footprint -= footprint(step);
+        step.spill_key  = spiller->spill(std::move(elements));
+        step.is_spilled = true;
+        history_footprint += footprint(step);
+        return true;
+    }
+
+    // Restores the spilled steps from the position on before a walk changes anything, so a spiller that throws leaves the collection as it was.
+    void restore_spilled_steps(std::size_t position)
+    {
+        for (; spilled_end > position; spilled_end--)
+            restore_step(steps[spilled_end - 1]);
+    }
+
+    void restore_step(step_range& step)
+    {
+        if (!step.is_spilled)
+            return;
+
+        history_footprint -= footprint(step);
+        auto elements = spiller->restore(step.spill_key);
+        auto element  = elements.begin();
+        for_each_retained(step, [&](TElement& slot) { slot = std::move(*element++); });
+        step.is_spilled = false;
+        history_footprint += footprint(step);
+    }
+
+    void discard_redo_steps()
+    {
+        auto first     = first_step + undo_steps_index;
+        auto begin     = steps[first].begin;
+        auto bulk_size = bulk_indices.size();
+        auto patch_size = patches.size();
+        for (auto step = first; step < steps.size(); step++)
+            history_footprint -= footprint(steps[step]);
+        clean_up_records(begin, records.size());
+        for (auto index = begin; index < records.size(); index++) {
+            if (records[index].is_bulk())
+                bulk_size = (std::min)(bulk_size, records[index].index);
+            else if (records[index].operation == operation_type::patch)
+                patch_size = (std::min)(patch_size, records[index].index);
+        }
+
+        records      .erase(std::next(records      .begin(), begin     ), records      .end());
+        bulk_indices .erase(std::next(bulk_indices .begin(), bulk_size ), bulk_indices .end());
+        bulk_elements.erase(std::next(bulk_elements.begin(), bulk_size ), bulk_elements.end());
+        patches      .erase(std::next(patches      .begin(), patch_size), patches      .end());
+        steps        .erase(std::next(steps        .begin(), first    ), steps        .end());
+        drop_checkpoints(std::upper_bound(checkpoints.begin(), checkpoints.end(), first, [](std::size_t position, const checkpoint& checkpoint) { return position < checkpoint.position; }), checkpoints.end());
+        if (in_transaction)
+            transaction_begin = records.size();
+    }
+
+    bool is_history_over_limit() const
+    {
+        return (maximum_history_steps != 0 && history_size() > maximum_history_steps) ||
+               (maximum_history_bytes != 0 && history_footprint > maximum_history_bytes);
+    }
+
+    // Only the applied steps can go; dropping a redo step would break the chain.
+    // Dropped steps stay in the log as a dead prefix until it outgrows the live part, so trimming is amortized O(1).
+    void trim_undo_steps()
+    {
+        auto trimmed = false;
+        while (is_history_over_limit() && undo_steps_index > 0 && history_size() > 1) {
+            const auto& step = steps[first_step];
+            history_footprint -= footprint(step);
+            clean_up_step(step);
+            dead_records = step.end;
+            first_step++;
+            undo_steps_index--;
+            if (!checkpoints.empty() && checkpoints.front().position < first_step)
+                drop_checkpoints(checkpoints.begin(), std::next(checkpoints.begin()));
+            trimmed = true;
+        }
+        if (trimmed && dead_records >= records.size() - dead_records)
+            compact();
+    }
+
+    void compact()
+    {
+        auto bulk_begin  = bulk_indices.size();
+        auto patch_begin = patches.size();
+        for (auto index = dead_records; index < records.size(); index++) {
+            if (records[index].is_bulk())
+                bulk_begin = (std::min)(bulk_begin, records[index].index);
+            else if (records[index].operation == operation_type::patch)
+                patch_begin = (std::min)(patch_begin, records[index].index);
+        }
+
+        records      .erase(records      .begin(), std::next(records      .begin(), dead_records));
+        bulk_indices .erase(bulk_indices .begin(), std::next(bulk_indices .begin(), bulk_begin  ));
+        bulk_elements.erase(bulk_elements.begin(), std::next(bulk_elements.begin(), bulk_begin  ));
+        patches      .erase(patches      .begin(), std::next(patches      .begin(), patch_begin ));
+        steps        .erase(steps        .begin(), std::next(steps        .begin(), first_step  ));
+        for (auto& record : records) {
+            if (record.is_bulk())
+                record.index -= bulk_begin;
+            else if (record.operation == operation_type::patch)
+                record.index -= patch_begin;
+        }
+        for (auto& step : steps) {
+            step.begin -= dead_records;
+            step.end   -= dead_records;
+        }
+        if (in_transaction)
+            transaction_begin -= dead_records;
+        for (auto& checkpoint : checkpoints)
+            checkpoint.position -= first_step;
+        spilled_end  = spilled_end > first_step ? spilled_end - first_step : 0;
+        first_step   = 0;
+        dead_records = 0;
+    }
+
+    void reset_undo_steps()
+    {
+        for (auto step = first_step; step < steps.size(); step++)
+            clean_up_step(steps[step]);
+        clean_up_records(steps.size() > first_step ? steps.back().end : dead_records, records.size());
+        records      .clear();
+        steps        .clear();
+        bulk_indices .clear();
+        bulk_elements.clear();
+        patches      .clear();
+        checkpoints  .clear();
+
+        in_transaction    = false;
+        first_step        = 0;
+        dead_records      = 0;
+        spilled_end       = 0;
+        undo_steps_index  = 0;
+        can_coalesce      = false;
+        history_footprint = 0;
     }
 
     void clean_up_elements()
     {
-        std::for_each(this->begin(), this->end(), [&](TElement element) { (*clean_up)(element); });
+        if (dispose.enabled())
+            std::for_each(data.begin(), data.end(), dispose);
         data.clear();
     }
 };
 
-template <typename TElement, typename TCollection = std::vector<TElement*>>
-class undo_redo_pointer_collection : public undo_redo_collection<TElement*, TCollection>
+// Maps each element of an undo_redo_collection to its position. The elements must be unique.
+// Positions behind an insertion or erasure in the middle are repaired lazily on the next lookup.
+template <typename TElement, typename TCollection = std::vector<TElement>, typename TDisposer = function_disposer<TElement>>
+class index_map : public collection_observer<TElement>
 {
+    undo_redo_collection<TElement, TCollection, TDisposer>& collection;
+    std::unordered_map<TElement, std::size_t>    indices;
+    std::size_t                                  valid_size;
+
 public:
-    undo_redo_pointer_collection() : undo_redo_collection<TElement*, TCollection>([](TElement* pointer) { delete pointer; })
-    {}
+    index_map(undo_redo_collection<TElement, TCollection, TDisposer>& collection) : collection(collection), valid_size(0)
+    {
+        collection.add_observer(*this);
+    }
+
+    index_map(const index_map&) = delete;
+    index_map& operator =(const index_map&) = delete;
+
+    virtual ~index_map()
+    {
+        collection.remove_observer(*this);
+    }
+
+    bool find(const TElement& element, std::size_t& index)
+    {
+        auto iterator = indices.find(element);
+        if (iterator == indices.end() ? valid_size != collection.size() : iterator->second >= valid_size) {
+            // repair may rehash, which invalidates the iterator
+            repair();
+            iterator = indices.find(element);
+        }
+        if (iterator == indices.end())
+            return false;
+        index = iterator->second;
+        return true;
+    }
+
+    virtual void on_added(std::size_t index, const TElement& element) override
+    {
+        if (index == valid_size && index + 1 == collection.size())
+            valid_size++;
+        else
+            valid_size = (std::min)(valid_size, index);
+        indices[element] = index;
+    }
+
+    virtual void on_removed(std::size_t index, const TElement& element) override
+    {
+        indices.erase(element);
+        valid_size = (std::min)(valid_size, index);
+    }
+
+    virtual void on_updated(std::size_t index, const TElement& old_element, const TElement& new_element) override
+    {
+        indices.erase(old_element);
+        indices[new_element] = index;
+    }
+
+    // An element changed in place stays where it is.
+    virtual void on_changing(std::size_t /* index */, const TElement& /* element */) override {}
+    virtual void on_changed (std::size_t /* index */, const TElement& /* element */) override {}
+
+    virtual void on_reset() override
+    {
+        indices.clear();
+        valid_size = 0;
+    }
+
+private:
+    void repair()
+    {
+        indices.reserve(collection.size());
+        for (; valid_size < collection.size(); valid_size++)
+            indices[collection[valid_size]] = valid_size;
+    }
 };
 
+template <typename TElement, typename TCollection = std::vector<TElement*>>
+class undo_redo_pointer_collection : public undo_redo_collection<TElement*, TCollection, delete_disposer>
+{};
+
 template <typename TElement>
 using undo_redo_vector = undo_redo_collection<TElement>;
 
 template <typename TElement>
 using undo_redo_pointer_vector = undo_redo_pointer_collection<TElement>;
 
+// For large collections edited in the middle: undo and erase there move one chunk of elements instead of the tail of the whole collection.
+template <typename TElement>
+using undo_redo_chunked_vector = undo_redo_collection<TElement, chunked_vector<TElement>>;
+
+template <typename TElement>
+using undo_redo_pointer_chunked_vector = undo_redo_pointer_collection<TElement, chunked_vector<TElement*>>;
+
+template <typename TElement>
+using pointer_index_map = index_map<TElement*, std::vector<TElement*>, delete_disposer>;
+
 } // namespace shos